@@ -0,0 +1,1099 @@
+// SPDX-License-Identifier: MIT
+
+// Texture atlas builder: decodes a directory of sprites in parallel, trims their transparent borders, packs them into
+// as many pages as needed and writes the pages as TGA images, plus a binary index of where every sprite went.
+//
+// The index is an AtlasHeader, then one AtlasSprite per input sorted by name, then the names, UTF-8 and not
+// NUL-terminated.
+// Native-endian like the other indexes here. Page n is "<prefix>-<n>.tga", 32-bit, top-left origin.
+
+#include "hk.hh"
+#include "rectpack.hh"
+#include "threads.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+using namespace hk;
+
+namespace fs = std::filesystem;
+
+static const char ATLAS_MAGIC[4] = { 'H', 'K', 'A', 'T' };
+static constexpr u32 ATLAS_VERSION = 1;
+
+struct AtlasHeader {
+    char magic[4];
+    u32 version;
+    u32 pages;
+    u32 sprites;
+    u32 page_w;
+    u32 page_h;
+    u32 names_size;
+    u32 reserved;
+};
+
+// Turned 90 degrees clockwise in the atlas: w and h are as placed, and source pixel (sx, sy) is at
+// (x + h - 1 - sy, y + sx)
+static constexpr u32 SPRITE_ROTATED = 1 << 0;
+
+// x, y, w and h are the trimmed sprite's place on its page; it came from (trim_x, trim_y) of the source_w x
+// source_h image. A fully transparent sprite has w = h = 0 and no place.
+struct AtlasSprite {
+    u32 name_offset;
+    u32 name_size;
+    u32 page;
+    u32 x;
+    u32 y;
+    u32 w;
+    u32 h;
+    u32 trim_x;
+    u32 trim_y;
+    u32 source_w;
+    u32 source_h;
+    u32 flags;
+};
+
+static f64 seconds() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ==============================
+// Images
+// ==============================
+
+// 8-bit RGBA, rows top to bottom
+struct Image {
+    u32 w;
+    u32 h;
+    std::vector<u8> pixels;
+};
+
+static bool read_file(const std::string& path, std::vector<u8>* data) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    u8 buf[64 * 1024];
+    usize n = 0;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) {
+        data->insert(data->end(), buf, buf + n);
+    }
+    const bool ok = !std::ferror(f);
+    std::fclose(f);
+    return ok;
+}
+
+// Uncompressed and RLE truecolor (24 and 32-bit) and grayscale (8-bit) TGA
+static bool decode_tga(Span<const u8> data, Image* image) {
+    if (data.size() < 18) {
+        return false;
+    }
+    const u8 id_size = data[0];
+    const u8 color_map = data[1];
+    const u8 type = data[2];
+    const u32 w = data[12] | (u32)data[13] << 8;
+    const u32 h = data[14] | (u32)data[15] << 8;
+    const u8 bpp = data[16];
+    const bool top_down = (data[17] & 0x20) != 0;
+    const bool rle = type == 10 || type == 11;
+    const bool gray = type == 3 || type == 11;
+    if (color_map != 0 || (type != 2 && type != 3 && type != 10 && type != 11) ||
+        (gray ? bpp != 8 : bpp != 24 && bpp != 32)) {
+        return false;
+    }
+
+    const u32 size = bpp / 8;
+    const usize count = (usize)w * h;
+    usize at = 18 + id_size;
+    image->w = w;
+    image->h = h;
+    image->pixels.resize(count * 4);
+    usize i = 0;
+    while (i < count) {
+        // Raw data is one packet of every pixel
+        usize run = count;
+        bool repeat = false;
+        if (rle) {
+            if (at >= data.size()) {
+                return false;
+            }
+            repeat = (data[at] & 0x80) != 0;
+            run = (data[at] & 0x7F) + 1u;
+            at += 1;
+        }
+        run = min(run, count - i);
+        if (at + (repeat ? 1 : run) * size > data.size()) {
+            return false;
+        }
+        for (usize k = 0; k < run; ++k, ++i) {
+            const u8* p = &data[repeat ? at : at + k * size];
+            // Rows are stored bottom up unless the descriptor says otherwise
+            const usize y = top_down ? i / w : h - 1 - i / w;
+            u8* q = &image->pixels[(y * w + i % w) * 4];
+            if (gray) {
+                q[0] = q[1] = q[2] = p[0];
+                q[3] = 255;
+            } else {
+                q[0] = p[2];
+                q[1] = p[1];
+                q[2] = p[0];
+                q[3] = size == 4 ? p[3] : 255;
+            }
+        }
+        at += (repeat ? 1 : run) * size;
+    }
+    return true;
+}
+
+// Netpbm: binary PGM (P5), PPM (P6) and PAM (P7) with 1 to 4 channels, up to 8 bits each
+static bool decode_pnm(Span<const u8> data, Image* image) {
+    usize at = 2;
+    // Next whitespace separated token, skipping comments
+    auto token = [&]() -> std::string {
+        std::string t = std::string();
+        while (at < data.size()) {
+            const char c = (char)data[at];
+            if (c == '#') {
+                while (at < data.size() && data[at] != '\n') {
+                    at += 1;
+                }
+            } else if (isspace((unsigned char)c)) {
+                if (!t.empty()) {
+                    break;
+                }
+                at += 1;
+            } else {
+                t.push_back(c);
+                at += 1;
+            }
+        }
+        return t;
+    };
+
+    if (data.size() < 3 || data[0] != 'P' || (data[1] != '5' && data[1] != '6' && data[1] != '7')) {
+        return false;
+    }
+    u32 w = 0;
+    u32 h = 0;
+    u32 depth = data[1] == '5' ? 1 : 3;
+    u32 maxval = 0;
+    if (data[1] == '7') {
+        for (std::string t = token(); t != "ENDHDR"; t = token()) {
+            if (t.empty()) {
+                return false;
+            } else if (t == "WIDTH") {
+                w = (u32)strtoul(token().c_str(), nullptr, 10);
+            } else if (t == "HEIGHT") {
+                h = (u32)strtoul(token().c_str(), nullptr, 10);
+            } else if (t == "DEPTH") {
+                depth = (u32)strtoul(token().c_str(), nullptr, 10);
+            } else if (t == "MAXVAL") {
+                maxval = (u32)strtoul(token().c_str(), nullptr, 10);
+            } else if (t == "TUPLTYPE") {
+                token();
+            }
+        }
+    } else {
+        w = (u32)strtoul(token().c_str(), nullptr, 10);
+        h = (u32)strtoul(token().c_str(), nullptr, 10);
+        maxval = (u32)strtoul(token().c_str(), nullptr, 10);
+    }
+    // A single whitespace character ends the header
+    at += 1;
+    if (w == 0 || h == 0 || depth < 1 || depth > 4 || maxval < 1 || maxval > 255 ||
+        at + (usize)w * h * depth > data.size()) {
+        return false;
+    }
+
+    const usize count = (usize)w * h;
+    image->w = w;
+    image->h = h;
+    image->pixels.resize(count * 4);
+    for (usize i = 0; i < count; ++i) {
+        const u8* p = &data[at + i * depth];
+        u8* q = &image->pixels[i * 4];
+        u8 v[4] = { };
+        for (u32 c = 0; c < depth; ++c) {
+            v[c] = (u8)(min<u32>(p[c], maxval) * 255 / maxval);
+        }
+        // Gray, gray + alpha, RGB or RGBA
+        const bool color = depth >= 3;
+        q[0] = v[0];
+        q[1] = color ? v[1] : v[0];
+        q[2] = color ? v[2] : v[0];
+        q[3] = depth == 2 ? v[1] : depth == 4 ? v[3] : 255;
+    }
+    return true;
+}
+
+
+// Canonical Huffman code: how many codes there are of each length, and the symbols in code order
+struct Huffman {
+    u16 count[16];
+    u16 symbol[288];
+};
+
+// False for an over-subscribed code. An incomplete one is fine until a code it lacks turns up.
+static bool build_huffman(Huffman* huffman, const u8* lengths, u32 n) {
+    memset(huffman->count, 0, sizeof(huffman->count));
+    for (u32 i = 0; i < n; ++i) {
+        huffman->count[lengths[i]] += 1;
+    }
+    i32 left = 1;
+    for (u32 len = 1; len < 16; ++len) {
+        left = left * 2 - huffman->count[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    u16 offsets[16] = { };
+    for (u32 len = 1; len < 15; ++len) {
+        offsets[len + 1] = offsets[len] + huffman->count[len];
+    }
+    for (u32 i = 0; i < n; ++i) {
+        if (lengths[i] != 0) {
+            huffman->symbol[offsets[lengths[i]]++] = (u16)i;
+        }
+    }
+    return true;
+}
+
+struct BitReader {
+    Span<const u8> in;
+    usize at;
+    u32 buffer;
+    u32 count;
+    // Set once a read goes past the end, which then reads zeros
+    bool overrun;
+
+    u32 bits(u32 n) {
+        while (count < n) {
+            if (at == in.size()) {
+                overrun = true;
+                return 0;
+            }
+            buffer |= (u32)in[at++] << count;
+            count += 8;
+        }
+        const u32 v = buffer & ((1u << n) - 1);
+        buffer >>= n;
+        count -= n;
+        return v;
+    }
+
+    // A bit at a time, codes are sent most significant bit first. -1 for a code that isn't there.
+    i32 decode(const Huffman& huffman) {
+        i32 code = 0;
+        i32 first = 0;
+        i32 index = 0;
+        for (u32 len = 1; len < 16; ++len) {
+            code |= (i32)bits(1);
+            const i32 count = huffman.count[len];
+            if (code - first < count) {
+                return huffman.symbol[index + code - first];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+// Raw DEFLATE (RFC 1951) appended to out, which is reserved up front and mustn't grow past limit
+static bool inflate(Span<const u8> in, usize limit, std::vector<u8>* out) {
+    static const u16 LENGTH_BASE[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227,
+        258
+    };
+    static const u8 LENGTH_EXTRA[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const u16 DISTANCE_BASE[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+        6145, 8193, 12289, 16385, 24577
+    };
+    static const u8 DISTANCE_EXTRA[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    // Order the code length code lengths are sent in
+    static const u8 ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    BitReader reader = { in, 0, 0, 0, false };
+    Huffman literals = Huffman();
+    Huffman distances = Huffman();
+    bool last = false;
+    while (!last) {
+        last = reader.bits(1) != 0;
+        const u32 type = reader.bits(2);
+        if (reader.overrun) {
+            return false;
+        }
+
+        if (type == 0) {
+            // Stored: byte aligned, what's left in the buffer is padding
+            reader.buffer = 0;
+            reader.count = 0;
+            if (reader.at + 4 > in.size()) {
+                return false;
+            }
+            const u32 len = in[reader.at] | (u32)in[reader.at + 1] << 8;
+            const u32 nlen = in[reader.at + 2] | (u32)in[reader.at + 3] << 8;
+            reader.at += 4;
+            if (len != (~nlen & 0xFFFF) || len > in.size() - reader.at || len > limit - out->size()) {
+                return false;
+            }
+            out->insert(out->end(), &in[reader.at], &in[reader.at] + len);
+            reader.at += len;
+            continue;
+        }
+
+        if (type == 1) {
+            u8 lengths[288 + 30];
+            for (u32 i = 0; i < 288; ++i) {
+                lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            }
+            for (u32 i = 288; i < 288 + 30; ++i) {
+                lengths[i] = 5;
+            }
+            build_huffman(&literals, lengths, 288);
+            build_huffman(&distances, lengths + 288, 30);
+        } else if (type == 2) {
+            const u32 nlit = reader.bits(5) + 257;
+            const u32 ndist = reader.bits(5) + 1;
+            const u32 ncode = reader.bits(4) + 4;
+            if (nlit > 286 || ndist > 30) {
+                return false;
+            }
+            u8 code_lengths[19] = { };
+            for (u32 i = 0; i < ncode; ++i) {
+                code_lengths[ORDER[i]] = (u8)reader.bits(3);
+            }
+            Huffman code = Huffman();
+            if (!build_huffman(&code, code_lengths, 19)) {
+                return false;
+            }
+
+            u8 lengths[286 + 30] = { };
+            u32 i = 0;
+            while (i < nlit + ndist) {
+                const i32 symbol = reader.decode(code);
+                if (symbol < 0 || reader.overrun) {
+                    return false;
+                }
+                if (symbol < 16) {
+                    lengths[i++] = (u8)symbol;
+                    continue;
+                }
+                // 16 repeats the last length, 17 and 18 repeat zeros
+                u8 len = 0;
+                u32 repeat = 0;
+                if (symbol == 16) {
+                    if (i == 0) {
+                        return false;
+                    }
+                    len = lengths[i - 1];
+                    repeat = 3 + reader.bits(2);
+                } else if (symbol == 17) {
+                    repeat = 3 + reader.bits(3);
+                } else {
+                    repeat = 11 + reader.bits(7);
+                }
+                if (repeat > nlit + ndist - i) {
+                    return false;
+                }
+                memset(&lengths[i], len, repeat);
+                i += repeat;
+            }
+            if (lengths[256] == 0 || !build_huffman(&literals, lengths, nlit) ||
+                !build_huffman(&distances, lengths + nlit, ndist)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+
+        for (;;) {
+            i32 symbol = reader.decode(literals);
+            if (symbol < 0 || reader.overrun) {
+                return false;
+            }
+            if (symbol < 256) {
+                if (out->size() == limit) {
+                    return false;
+                }
+                out->push_back((u8)symbol);
+                continue;
+            }
+            if (symbol == 256) {
+                break;
+            }
+
+            symbol -= 257;
+            if (symbol >= 29) {
+                return false;
+            }
+            const u32 len = LENGTH_BASE[symbol] + reader.bits(LENGTH_EXTRA[symbol]);
+            const i32 d = reader.decode(distances);
+            if (d < 0 || d >= 30) {
+                return false;
+            }
+            const u32 distance = DISTANCE_BASE[d] + reader.bits(DISTANCE_EXTRA[d]);
+            if (reader.overrun || distance > out->size() || len > limit - out->size()) {
+                return false;
+            }
+            // The copy may overlap what it writes, byte by byte repeats the pattern
+            const usize from = out->size() - distance;
+            for (usize k = 0; k < len; ++k) {
+                const u8 byte = (*out)[from + k];
+                out->push_back(byte);
+            }
+        }
+    }
+    return true;
+}
+
+static u32 read_u32_be(const u8* p) {
+    return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3];
+}
+
+// Undoes one scanline's filter in place. prior is the previous scanline, already unfiltered, or zeros.
+static bool unfilter_row(u8* row, const u8* prior, usize stride, usize pixel_bytes, u8 filter) {
+    switch (filter) {
+    case 0: { } break;
+    case 1: {
+        for (usize i = pixel_bytes; i < stride; ++i) {
+            row[i] = (u8)(row[i] + row[i - pixel_bytes]);
+        }
+    } break;
+    case 2: {
+        for (usize i = 0; i < stride; ++i) {
+            row[i] = (u8)(row[i] + prior[i]);
+        }
+    } break;
+    case 3: {
+        for (usize i = 0; i < stride; ++i) {
+            const u32 left = i >= pixel_bytes ? row[i - pixel_bytes] : 0;
+            row[i] = (u8)(row[i] + (left + prior[i]) / 2);
+        }
+    } break;
+    case 4: {
+        for (usize i = 0; i < stride; ++i) {
+            const i32 a = i >= pixel_bytes ? row[i - pixel_bytes] : 0;
+            const i32 b = prior[i];
+            const i32 c = i >= pixel_bytes ? prior[i - pixel_bytes] : 0;
+            const i32 pa = std::abs(b - c);
+            const i32 pb = std::abs(a - c);
+            const i32 pc = std::abs(a + b - 2 * c);
+            row[i] = (u8)(row[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+        }
+    } break;
+    default: { return false; } break;
+    }
+    return true;
+}
+
+// Every color type and bit depth, palettes, tRNS transparency and Adam7 interlacing. 16-bit samples keep their high
+// byte. Chunk CRCs and the zlib checksum aren't checked.
+static bool decode_png(Span<const u8> data, Image* image) {
+    static const u8 SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    // x, y, x step and y step of each Adam7 pass
+    static const u8 ADAM7[7][4] = {
+        { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+    };
+    static const u8 PROGRESSIVE[4] = { 0, 0, 1, 1 };
+    if (data.size() < sizeof(SIGNATURE) || memcmp(data.data(), SIGNATURE, sizeof(SIGNATURE)) != 0) {
+        return false;
+    }
+
+    bool header = false;
+    u32 w = 0;
+    u32 h = 0;
+    u32 depth = 0;
+    u32 color = 0;
+    bool interlaced = false;
+    u8 palette[256 * 4] = { };
+    u32 palette_size = 0;
+    // Color key from tRNS for gray and RGB, in sample values
+    bool keyed = false;
+    u32 key[3] = { };
+    std::vector<u8> compressed = std::vector<u8>();
+    usize at = sizeof(SIGNATURE);
+    for (;;) {
+        if (at + 12 > data.size()) {
+            return false;
+        }
+        const u32 length = read_u32_be(&data[at]);
+        const u8* type = &data[at + 4];
+        const u8* body = &data[at + 8];
+        if (length > data.size() - at - 12) {
+            return false;
+        }
+        at += 12 + (usize)length;
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (length != 13 || body[10] != 0 || body[11] != 0 || body[12] > 1) {
+                return false;
+            }
+            w = read_u32_be(body);
+            h = read_u32_be(body + 4);
+            depth = body[8];
+            color = body[9];
+            interlaced = body[12] == 1;
+            header = true;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            if (length % 3 != 0 || length / 3 > 256) {
+                return false;
+            }
+            palette_size = length / 3;
+            for (u32 i = 0; i < palette_size; ++i) {
+                memcpy(&palette[i * 4], &body[i * 3], 3);
+                palette[i * 4 + 3] = 255;
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            if (color == 3 && length <= palette_size) {
+                for (u32 i = 0; i < length; ++i) {
+                    palette[i * 4 + 3] = body[i];
+                }
+            } else if ((color == 0 && length == 2) || (color == 2 && length == 6)) {
+                for (u32 c = 0; c < length / 2; ++c) {
+                    key[c] = (u32)body[c * 2] << 8 | body[c * 2 + 1];
+                }
+                keyed = true;
+            } else {
+                return false;
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            compressed.insert(compressed.end(), body, body + length);
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        } else if ((type[0] & 0x20) == 0) {
+            // An unknown critical chunk
+            return false;
+        }
+    }
+
+    u32 channels = 0;
+    switch (color) {
+    case 0: { channels = 1; } break;
+    case 2: { channels = 3; } break;
+    case 3: { channels = 1; } break;
+    case 4: { channels = 2; } break;
+    case 6: { channels = 4; } break;
+    default: { return false; } break;
+    }
+    const bool packed = depth == 1 || depth == 2 || depth == 4;
+    if (!header || w == 0 || h == 0 || w > (1 << 16) || h > (1 << 16) || (color == 3 && palette_size == 0) ||
+        !(depth == 8 || (depth == 16 && color != 3) || (packed && (color == 0 || color == 3)))) {
+        return false;
+    }
+
+    // What the passes inflate to: a filter byte then the packed samples, per scanline
+    const u32 pixel_bits = channels * depth;
+    const usize pixel_bytes = max<usize>(1, pixel_bits / 8);
+    const u32 passes = interlaced ? 7 : 1;
+    usize raw_size = 0;
+    for (u32 p = 0; p < passes; ++p) {
+        const u8* pass = interlaced ? ADAM7[p] : PROGRESSIVE;
+        const usize pass_w = w > pass[0] ? (w - pass[0] + pass[2] - 1) / pass[2] : 0;
+        const usize pass_h = h > pass[1] ? (h - pass[1] + pass[3] - 1) / pass[3] : 0;
+        if (pass_w > 0) {
+            raw_size += pass_h * (1 + (pass_w * pixel_bits + 7) / 8);
+        }
+    }
+
+    // zlib wrapper: deflate, no preset dictionary
+    if (compressed.size() < 2 || (compressed[0] & 0x0F) != 8 || (compressed[1] & 0x20) != 0 ||
+        ((u32)compressed[0] << 8 | compressed[1]) % 31 != 0) {
+        return false;
+    }
+    std::vector<u8> raw = std::vector<u8>();
+    raw.reserve(raw_size);
+    if (!inflate(Span<const u8>(&compressed[2], compressed.size() - 2), raw_size, &raw) || raw.size() != raw_size) {
+        return false;
+    }
+
+    image->w = w;
+    image->h = h;
+    image->pixels.assign((usize)w * h * 4, 0);
+    const u32 max_sample = (1u << depth) - 1;
+    auto sample = [&](const u8* row, usize index) -> u32 {
+        if (depth == 8) {
+            return row[index];
+        }
+        if (depth == 16) {
+            return (u32)row[index * 2] << 8 | row[index * 2 + 1];
+        }
+        const usize bit = index * depth;
+        return (row[bit / 8] >> (8 - depth - bit % 8)) & max_sample;
+    };
+    auto to_u8 = [&](u32 v) -> u8 {
+        return (u8)(depth == 16 ? v >> 8 : depth == 8 ? v : v * 255 / max_sample);
+    };
+
+    std::vector<u8> zeros = std::vector<u8>();
+    usize offset = 0;
+    for (u32 p = 0; p < passes; ++p) {
+        const u8* pass = interlaced ? ADAM7[p] : PROGRESSIVE;
+        const u32 pass_w = w > pass[0] ? (w - pass[0] + pass[2] - 1) / pass[2] : 0;
+        const u32 pass_h = h > pass[1] ? (h - pass[1] + pass[3] - 1) / pass[3] : 0;
+        if (pass_w == 0) {
+            continue;
+        }
+        const usize stride = ((usize)pass_w * pixel_bits + 7) / 8;
+        zeros.assign(stride, 0);
+        for (u32 y = 0; y < pass_h; ++y) {
+            u8* row = &raw[offset + 1];
+            const u8* prior = y > 0 ? row - (1 + stride) : zeros.data();
+            if (!unfilter_row(row, prior, stride, pixel_bytes, raw[offset])) {
+                return false;
+            }
+            offset += 1 + stride;
+
+            const usize out_y = pass[1] + (usize)y * pass[3];
+            for (u32 x = 0; x < pass_w; ++x) {
+                const usize out_x = pass[0] + (usize)x * pass[2];
+                u8* q = &image->pixels[(out_y * w + out_x) * 4];
+                const usize i = (usize)x * channels;
+                switch (color) {
+                case 0: {
+                    const u32 v = sample(row, i);
+                    q[0] = q[1] = q[2] = to_u8(v);
+                    q[3] = keyed && v == key[0] ? 0 : 255;
+                } break;
+                case 2: {
+                    const u32 r = sample(row, i);
+                    const u32 g = sample(row, i + 1);
+                    const u32 b = sample(row, i + 2);
+                    q[0] = to_u8(r);
+                    q[1] = to_u8(g);
+                    q[2] = to_u8(b);
+                    q[3] = keyed && r == key[0] && g == key[1] && b == key[2] ? 0 : 255;
+                } break;
+                case 3: {
+                    const u32 index = sample(row, i);
+                    if (index >= palette_size) {
+                        return false;
+                    }
+                    memcpy(q, &palette[index * 4], 4);
+                } break;
+                case 4: {
+                    q[0] = q[1] = q[2] = to_u8(sample(row, i));
+                    q[3] = to_u8(sample(row, i + 1));
+                } break;
+                case 6: {
+                    for (u32 c = 0; c < 4; ++c) {
+                        q[c] = to_u8(sample(row, i + c));
+                    }
+                } break;
+                default: { } break;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static bool is_image_path(const fs::path& path) {
+    static const char* EXTENSIONS[] = { ".png", ".tga", ".pgm", ".ppm", ".pam" };
+    const std::string ext = path.extension().string();
+    for (const char* e : EXTENSIONS) {
+        if (str::ieq(ext.c_str(), e)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool decode_image(const std::string& path, Image* image) {
+    std::vector<u8> data = std::vector<u8>();
+    if (!read_file(path, &data)) {
+        return false;
+    }
+    // PNG and Netpbm have magic numbers, TGA doesn't
+    if (data.size() >= 4 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G') {
+        return decode_png(data, image);
+    }
+    if (data.size() >= 2 && data[0] == 'P' && data[1] >= '5' && data[1] <= '7') {
+        return decode_pnm(data, image);
+    }
+    return decode_tga(data, image);
+}
+
+// Bounds of the pixels with any alpha, or an empty rect if there are none
+static void opaque_bounds(const Image& image, u32* x0, u32* y0, u32* x1, u32* y1) {
+    *x0 = image.w;
+    *y0 = image.h;
+    *x1 = 0;
+    *y1 = 0;
+    for (u32 y = 0; y < image.h; ++y) {
+        const u8* row = &image.pixels[(usize)y * image.w * 4];
+        u32 first = 0;
+        while (first < image.w && row[first * 4 + 3] == 0) {
+            first += 1;
+        }
+        if (first == image.w) {
+            continue;
+        }
+        u32 last = image.w;
+        while (row[(last - 1) * 4 + 3] == 0) {
+            last -= 1;
+        }
+        *x0 = min(*x0, first);
+        *x1 = max(*x1, last);
+        *y0 = min(*y0, y);
+        *y1 = y + 1;
+    }
+    if (*x1 == 0) {
+        *x0 = *y0 = 0;
+    }
+}
+
+static void crop(Image* image, u32 x0, u32 y0, u32 x1, u32 y1) {
+    std::vector<u8> pixels = std::vector<u8>((usize)(x1 - x0) * (y1 - y0) * 4);
+    for (u32 y = y0; y < y1; ++y) {
+        memcpy(&pixels[(usize)(y - y0) * (x1 - x0) * 4], &image->pixels[((usize)y * image->w + x0) * 4], (x1 - x0) * 4);
+    }
+    image->w = x1 - x0;
+    image->h = y1 - y0;
+    image->pixels.swap(pixels);
+}
+
+// 32-bit RLE TGA, packets never crossing a row
+static void encode_tga(const Image& image, std::vector<u8>* out) {
+    const u8 header[18] = {
+        0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        (u8)image.w, (u8)(image.w >> 8), (u8)image.h, (u8)(image.h >> 8), 32, 0x28
+    };
+    out->assign(header, header + sizeof(header));
+    auto pixel = [&](const u8* p) {
+        const u8 bgra[4] = { p[2], p[1], p[0], p[3] };
+        out->insert(out->end(), bgra, bgra + 4);
+    };
+    for (u32 y = 0; y < image.h; ++y) {
+        const u8* row = &image.pixels[(usize)y * image.w * 4];
+        auto same = [&](u32 a, u32 b) { return memcmp(&row[a * 4], &row[b * 4], 4) == 0; };
+        u32 x = 0;
+        while (x < image.w) {
+            u32 run = 1;
+            while (x + run < image.w && run < 128 && same(x, x + run)) {
+                run += 1;
+            }
+            if (run >= 2) {
+                out->push_back((u8)(0x80 | (run - 1)));
+                pixel(&row[x * 4]);
+                x += run;
+                continue;
+            }
+            // Raw up to where the next run starts
+            run = 1;
+            while (x + run < image.w && run < 128 && !(x + run + 1 < image.w && same(x + run, x + run + 1))) {
+                run += 1;
+            }
+            out->push_back((u8)(run - 1));
+            for (u32 k = 0; k < run; ++k) {
+                pixel(&row[(x + k) * 4]);
+            }
+            x += run;
+        }
+    }
+}
+
+static bool write_file(const std::string& path, Span<const u8> data) {
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    bool ok = data.size() == 0 || std::fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (std::fclose(f) == 0) && ok;
+    return ok;
+}
+
+// ==============================
+// Atlas
+// ==============================
+
+struct Sprite {
+    std::string path;
+    std::string name;
+    // Trimmed
+    Image image;
+    u32 trim_x;
+    u32 trim_y;
+    u32 source_w;
+    u32 source_h;
+};
+
+static bool write_index(const std::string& path, Span<const Sprite> sprites, Span<const PackRect> rects,
+                        Span<const u32> rect_of, u32 pages, u32 page_w, u32 page_h) {
+    std::vector<AtlasSprite> entries = std::vector<AtlasSprite>(sprites.size());
+    std::string names = std::string();
+    for (usize i = 0; i < sprites.size(); ++i) {
+        const Sprite& s = sprites[i];
+        AtlasSprite& e = entries[i];
+        e.name_offset = (u32)names.size();
+        e.name_size = (u32)s.name.size();
+        names += s.name;
+        e.trim_x = s.trim_x;
+        e.trim_y = s.trim_y;
+        e.source_w = s.source_w;
+        e.source_h = s.source_h;
+        if (rect_of[i] != UINT32_MAX) {
+            const PackRect& r = rects[rect_of[i]];
+            e.page = r.bin;
+            e.x = r.x;
+            e.y = r.y;
+            e.w = r.rotated ? s.image.h : s.image.w;
+            e.h = r.rotated ? s.image.w : s.image.h;
+            e.flags = r.rotated ? SPRITE_ROTATED : 0;
+        }
+    }
+
+    AtlasHeader header = AtlasHeader();
+    memcpy(header.magic, ATLAS_MAGIC, sizeof(header.magic));
+    header.version = ATLAS_VERSION;
+    header.pages = pages;
+    header.sprites = (u32)entries.size();
+    header.page_w = page_w;
+    header.page_h = page_h;
+    header.names_size = (u32)names.size();
+
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+    if (!entries.empty()) {
+        ok = ok && std::fwrite(entries.data(), sizeof(AtlasSprite), entries.size(), f) == entries.size();
+    }
+    if (!names.empty()) {
+        ok = ok && std::fwrite(names.data(), 1, names.size(), f) == names.size();
+    }
+    ok = (std::fclose(f) == 0) && ok;
+    return ok;
+}
+
+// Copies the sprite to (x, y) of the page, turned clockwise if rotated
+static void blit(Image* page, const Image& sprite, u32 x, u32 y, bool rotated) {
+    if (!rotated) {
+        for (u32 sy = 0; sy < sprite.h; ++sy) {
+            memcpy(&page->pixels[((usize)(y + sy) * page->w + x) * 4], &sprite.pixels[(usize)sy * sprite.w * 4], sprite.w * 4);
+        }
+        return;
+    }
+    for (u32 sy = 0; sy < sprite.h; ++sy) {
+        for (u32 sx = 0; sx < sprite.w; ++sx) {
+            memcpy(&page->pixels[((usize)(y + sx) * page->w + x + sprite.h - 1 - sy) * 4],
+                &sprite.pixels[((usize)sy * sprite.w + sx) * 4], 4);
+        }
+    }
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: atlas-build [options] <dir>\n"
+        "\n"
+        "Packs the PNG, TGA, PGM, PPM and PAM images under dir into \"<prefix>-<n>.tga\" pages and writes where each\n"
+        "went to \"<prefix>.atlas\".\n"
+        "\n"
+        "Options:\n"
+        "  -o <prefix>     Output prefix (default: atlas)\n"
+        "  -W <n>          Page width (default: 2048)\n"
+        "  -H <n>          Page height (default: 2048)\n"
+        "  -p <packer>     Packing algorithm (default: %s)\n"
+        "  -s <order>      Sort order before packing (default: %s)\n"
+        "  --strategy <s>  How sprites are spread over pages (default: %s)\n"
+        "  --padding <n>   Transparent pixels between sprites (default: 1)\n"
+        "  --no-trim       Keep transparent borders\n"
+        "  --may-rotate    Let the packer turn sprites\n"
+        "  -j <n>          Number of threads (default: all cores)\n",
+        packer_name(PackerKind::MAXRECTS_BSSF), sort_order_name(SortOrder::AREA_DESC),
+        bin_strategy_name(BinStrategy::DISTRIBUTE));
+}
+
+int main(int argc, const char* argv[]) {
+    u32 page_w = 2048;
+    u32 page_h = 2048;
+    BinOptions options = { PackerKind::MAXRECTS_BSSF, SortOrder::AREA_DESC, BinStrategy::DISTRIBUTE };
+    u32 padding = 1;
+    bool trim = true;
+    bool may_rotate = false;
+    usize threads = 0;
+    const char* prefix = "atlas";
+    const char* input = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            page_w = (u32)clamp(atoi(argv[++i]), 1, 65535);
+        } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            page_h = (u32)clamp(atoi(argv[++i]), 1, 65535);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            if (!packer_from_name(argv[++i], &options.packer)) {
+                fprintf(stderr, "Unknown packer %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (!sort_order_from_name(argv[++i], &options.order)) {
+                fprintf(stderr, "Unknown sort order %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--strategy") == 0 && i + 1 < argc) {
+            if (!bin_strategy_from_name(argv[++i], &options.strategy)) {
+                fprintf(stderr, "Unknown bin strategy %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--padding") == 0 && i + 1 < argc) {
+            padding = (u32)max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--no-trim") == 0) {
+            trim = false;
+        } else if (strcmp(argv[i], "--may-rotate") == 0) {
+            may_rotate = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (usize)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else if (argv[i][0] == '-' || input != nullptr) {
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            input = argv[i];
+        }
+    }
+    if (input == nullptr) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // Sorted by name, so the index can be searched and the same inputs always give the same atlas
+    std::vector<Sprite> sprites = std::vector<Sprite>();
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it = fs::recursive_directory_iterator(input, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        if (it->is_regular_file(ec) && is_image_path(it->path())) {
+            Sprite s = Sprite();
+            s.path = it->path().string();
+            s.name = it->path().lexically_relative(input).generic_string();
+            sprites.push_back(std::move(s));
+        }
+    }
+    if (ec) {
+        fprintf(stderr, "Failed to list %s\n", input);
+        return EXIT_FAILURE;
+    }
+    std::sort(sprites.begin(), sprites.end(), [](const Sprite& a, const Sprite& b) { return a.name < b.name; });
+
+    ThreadPool pool = ThreadPool(threads);
+    std::mutex lock;
+    int status = EXIT_SUCCESS;
+
+    // Decode and trim, a job per sprite
+    f64 start = seconds();
+    for (Sprite& sprite : sprites) {
+        pool.submit([&, p = &sprite]() {
+            Sprite& s = *p;
+            if (!decode_image(s.path, &s.image)) {
+                std::lock_guard<std::mutex> lk(lock);
+                fprintf(stderr, "Failed to decode %s\n", s.path.c_str());
+                status = EXIT_FAILURE;
+                return;
+            }
+            s.source_w = s.image.w;
+            s.source_h = s.image.h;
+            if (trim) {
+                u32 x0, y0, x1, y1;
+                opaque_bounds(s.image, &x0, &y0, &x1, &y1);
+                if (x0 != 0 || y0 != 0 || x1 != s.image.w || y1 != s.image.h) {
+                    crop(&s.image, x0, y0, x1, y1);
+                }
+                s.trim_x = x0;
+                s.trim_y = y0;
+            }
+        });
+    }
+    pool.wait();
+    if (status != EXIT_SUCCESS) {
+        return status;
+    }
+    const f64 decode_time = seconds() - start;
+
+    // Pack, with the padding on the right and bottom of each rect. Empty sprites don't take up a place.
+    start = seconds();
+    std::vector<PackRect> rects = std::vector<PackRect>();
+    std::vector<u32> rect_of = std::vector<u32>(sprites.size(), UINT32_MAX);
+    std::vector<u32> sprite_of = std::vector<u32>();
+    u64 sprite_area = 0;
+    for (u32 i = 0; i < (u32)sprites.size(); ++i) {
+        const Image& image = sprites[i].image;
+        if (image.w == 0 || image.h == 0) {
+            continue;
+        }
+        PackRect r = PackRect();
+        r.id = (u32)rects.size();
+        r.w = image.w + padding;
+        r.h = image.h + padding;
+        r.may_rotate = may_rotate;
+        rect_of[i] = r.id;
+        sprite_of.push_back(i);
+        sprite_area += (u64)image.w * image.h;
+        rects.push_back(r);
+    }
+    // Padding past the page's edge isn't needed
+    const u32 pages = pack_bins(&pool, page_w + padding, page_h + padding, rects, options);
+    for (const PackRect& r : rects) {
+        if (!r.packed) {
+            fprintf(stderr, "%s doesn't fit on a %ux%u page\n", sprites[sprite_of[r.id]].name.c_str(), page_w, page_h);
+            status = EXIT_FAILURE;
+        }
+    }
+    if (status != EXIT_SUCCESS) {
+        return status;
+    }
+    const f64 pack_time = seconds() - start;
+
+    // Compose, encode and write, a job per page, while the index is written here
+    start = seconds();
+    std::vector<std::vector<u32>> on_page = std::vector<std::vector<u32>>(pages);
+    for (const PackRect& r : rects) {
+        on_page[r.bin].push_back(r.id);
+    }
+    u64 encoded_size = 0;
+    for (u32 p = 0; p < pages; ++p) {
+        pool.submit([&, p]() {
+            Image page = { page_w, page_h, std::vector<u8>((usize)page_w * page_h * 4) };
+            for (u32 id : on_page[p]) {
+                const PackRect& r = rects[id];
+                blit(&page, sprites[sprite_of[id]].image, r.x, r.y, r.rotated);
+            }
+            std::vector<u8> encoded = std::vector<u8>();
+            encode_tga(page, &encoded);
+
+            const std::string path = std::string(prefix) + "-" + std::to_string(p) + ".tga";
+            const bool ok = write_file(path, encoded);
+            std::lock_guard<std::mutex> lk(lock);
+            encoded_size += encoded.size();
+            if (!ok) {
+                fprintf(stderr, "Failed to write %s\n", path.c_str());
+                status = EXIT_FAILURE;
+            }
+        });
+    }
+    const std::string index_path = std::string(prefix) + ".atlas";
+    const bool index_ok = write_index(index_path, sprites, rects, rect_of, pages, page_w, page_h);
+    pool.wait();
+    if (!index_ok) {
+        fprintf(stderr, "Failed to write %s\n", index_path.c_str());
+        status = EXIT_FAILURE;
+    }
+    const f64 encode_time = seconds() - start;
+
+    fprintf(stderr, "%u sprites on %u %ux%u pages, %.2f%% occupancy, %llu bytes\n", (u32)sprites.size(), pages, page_w,
+        page_h, pages > 0 ? 100.0 * (f64)sprite_area / ((f64)pages * page_w * page_h) : 0.0,
+        (unsigned long long)encoded_size);
+    fprintf(stderr, "decode %.0f ms, pack %.0f ms, encode %.0f ms, %u threads\n", decode_time * 1e3, pack_time * 1e3,
+        encode_time * 1e3, (u32)pool.size());
+    return status;
+}
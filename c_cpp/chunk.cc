@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: MIT
+
+// Content-defined chunking of files, with a persistent index of every chunk seen so shared regions between files
+// (and between runs) show up as shared bytes.
+
+#include "hk.hh"
+#include "chunker.hh"
+#include "hashio.hh"
+#include "threads.hh"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+
+using namespace hk;
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: chunk [options] <file|dir...>\n"
+        "       chunk --bench\n"
+        "\n"
+        "Options:\n"
+        "  -a <algorithm>  Chunk hash, md5 (default) or sha256\n"
+        "  -j <n>          Number of worker threads (default: one per hardware thread)\n"
+        "  --index <file>  Chunk index to count shared bytes against and add the new chunks to\n"
+        "  --min <n>       Minimum chunk size in bytes (default: %u)\n"
+        "  --avg <n>       Average chunk size in bytes, a power of two (default: %u)\n"
+        "  --max <n>       Maximum chunk size in bytes (default: %u)\n"
+        "  --bench         Compare the boundary scanners on random data\n",
+        (u32)DEFAULT_CHUNK_PARAMS.min_size, (u32)DEFAULT_CHUNK_PARAMS.avg_size, (u32)DEFAULT_CHUNK_PARAMS.max_size);
+}
+
+static f64 seconds() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+static f64 percent(u64 part, u64 total) {
+    return total > 0 ? 100.0 * (f64)part / (f64)total : 0.0;
+}
+
+// Every scanner must cut random data at the same places, then reports throughput of the cutting alone
+static int bench(const ChunkParams& params) {
+    constexpr usize BENCH_SIZE = 256 * 1024 * 1024;
+    std::vector<u8> data = std::vector<u8>(BENCH_SIZE);
+    RandomXOR rng = RandomXOR();
+    for (usize i = 0; i < data.size(); i += 4) {
+        const u32 r = rng.next();
+        memcpy(&data[i], &r, sizeof(r));
+    }
+
+    std::vector<usize> reference = std::vector<usize>();
+    int status = EXIT_SUCCESS;
+    for (u8 s = 0; s < (u8)GearScanner::COUNT; ++s) {
+        const GearScanner scanner = (GearScanner)s;
+        if (!gear_scanner_supported(scanner)) {
+            continue;
+        }
+        std::vector<usize> cuts = std::vector<usize>();
+        const f64 start = seconds();
+        for (usize offset = 0; offset < data.size(); ) {
+            offset += chunk_boundary(params, Span<const u8>(data).subspan(offset), scanner);
+            cuts.push_back(offset);
+        }
+        const f64 elapsed = seconds() - start;
+
+        if (reference.empty()) {
+            reference = cuts;
+        } else if (cuts != reference) {
+            fprintf(stderr, "%s: boundaries differ from %s\n", gear_scanner_name(scanner), gear_scanner_name(GearScanner::SCALAR));
+            status = EXIT_FAILURE;
+        }
+        printf("%-8s %8.2f GB/s  %u chunks, %u bytes average\n", gear_scanner_name(scanner),
+            (f64)data.size() / elapsed / 1e9, (u32)cuts.size(), (u32)(data.size() / cuts.size()));
+    }
+    return status;
+}
+
+int main(int argc, const char* argv[]) {
+    HashAlgo algo = HashAlgo::MD5;
+    usize threads = 0;
+    ChunkParams params = DEFAULT_CHUNK_PARAMS;
+    const char* index_path = nullptr;
+    bool run_bench = false;
+    std::vector<const char*> inputs = std::vector<const char*>();
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            if (!hash_algo_from_name(argv[++i], &algo)) {
+                fprintf(stderr, "Unknown algorithm %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (usize)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+            index_path = argv[++i];
+        } else if (strcmp(argv[i], "--min") == 0 && i + 1 < argc) {
+            params.min_size = (usize)atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--avg") == 0 && i + 1 < argc) {
+            params.avg_size = (usize)atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            params.max_size = (usize)atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            run_bench = true;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (!chunk_params_valid(params)) {
+        fprintf(stderr, "Chunk sizes need min <= avg <= max, with avg a power of two of at least 64\n");
+        return EXIT_FAILURE;
+    }
+    if (run_bench) {
+        return bench(params);
+    }
+    if (inputs.empty()) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    ChunkIndex index;
+    if (index_path != nullptr && !index.open(index_path, algo)) {
+        fprintf(stderr, "%s isn't a %s chunk index\n", index_path, hash_algo_name(algo));
+        return EXIT_FAILURE;
+    }
+    const usize indexed = index.size();
+
+    // One job per file, chunking is sequential within a file
+    int status = EXIT_SUCCESS;
+    std::mutex lock;
+    std::atomic<u64> files = std::atomic<u64>(0);
+    ThreadPool pool = ThreadPool(threads);
+    const FilesFn on_files = [&](std::vector<FileEntry> entries) {
+        for (FileEntry& e : entries) {
+            pool.submit([&, path = std::move(e.path)]() {
+                std::vector<ChunkInfo> chunks = std::vector<ChunkInfo>();
+                if (!chunk_file(path.c_str(), params, algo, &chunks)) {
+                    std::lock_guard<std::mutex> lk(lock);
+                    fprintf(stderr, "Failed to read %s\n", path.c_str());
+                    status = EXIT_FAILURE;
+                    return;
+                }
+                index.add(chunks);
+                files += 1;
+            });
+        }
+    };
+    const WalkErrorFn on_error = [&](const std::string& path) {
+        std::lock_guard<std::mutex> lk(lock);
+        fprintf(stderr, "Failed to read %s\n", path.c_str());
+        status = EXIT_FAILURE;
+    };
+    for (const char* input : inputs) {
+        std::error_code ec;
+        if (std::filesystem::is_directory(input, ec)) {
+            walk_tree(&pool, input, &on_files, &on_error);
+        } else {
+            on_files({ FileEntry{ input, 0 } });
+        }
+    }
+    pool.wait();
+
+    const ChunkIndex::Stats stats = index.merge();
+    printf("%llu files, %llu bytes in %llu chunks (%llu bytes average)\n",
+        (unsigned long long)files.load(), (unsigned long long)stats.bytes, (unsigned long long)stats.chunks,
+        (unsigned long long)(stats.chunks > 0 ? stats.bytes / stats.chunks : 0));
+    printf("unique: %llu bytes in %llu chunks (%.2f%%)\n",
+        (unsigned long long)stats.unique_bytes, (unsigned long long)stats.unique_chunks, percent(stats.unique_bytes, stats.bytes));
+    printf("shared: %llu bytes (%.2f%%)\n", (unsigned long long)stats.shared_bytes, percent(stats.shared_bytes, stats.bytes));
+
+    if (index_path != nullptr) {
+        printf("index:  %u chunks, %u before this run\n", (u32)index.size(), (u32)indexed);
+        if (!index.save()) {
+            fprintf(stderr, "Failed to write chunk index %s\n", index_path);
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
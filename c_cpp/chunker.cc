@@ -0,0 +1,381 @@
+// SPDX-License-Identifier: MIT
+
+#include "chunker.hh"
+#include "hashio.hh"
+
+#include <algorithm> // std::sort
+#include <filesystem> // std::filesystem::file_size
+
+#if defined(HK_GCC) && (defined(__x86_64__) || defined(__i386__))
+#   define CHUNKER_X86
+#   define CHUNKER_TARGET(isa) __attribute__((target(isa)))
+#   include <immintrin.h>
+#endif
+
+namespace hk {
+
+// ==============================
+// Content-defined chunking
+// ==============================
+
+struct GearTable {
+    u64 values[256];
+};
+
+// splitmix64, so the table is reproducible without pasting 2 KiB of constants. Changing it moves every boundary.
+static constexpr GearTable make_gear_table() {
+    GearTable table = GearTable();
+    u64 x = 0x2545F4914F6CDD1DULL;
+    for (usize i = 0; i < 256; ++i) {
+        x += 0x9E3779B97F4A7C15ULL;
+        u64 z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        table.values[i] = z ^ (z >> 31);
+    }
+    return table;
+}
+
+static constexpr GearTable GEAR = make_gear_table();
+
+// FastCDC's normalization level 2: two bits stricter before avg_size, two bits looser after
+static constexpr u32 GEAR_NORMALIZATION = 2;
+
+// Low bits of the gear hash only depend on the last few bytes, so masks always test the top bits
+static u64 gear_mask(u32 bits) {
+    return bits == 0 ? 0 : (~0ULL << (64 - bits));
+}
+
+bool chunk_params_valid(const ChunkParams& params) {
+    const bool pow2 = params.avg_size >= 64 && (params.avg_size & (params.avg_size - 1)) == 0;
+    return pow2 && params.min_size <= params.avg_size && params.avg_size <= params.max_size && params.max_size <= 0xFFFFFFFF;
+}
+
+const char* gear_scanner_name(GearScanner scanner) {
+    switch (scanner) {
+    case GearScanner::SCALAR: { return "scalar"; } break;
+    case GearScanner::AVX2:   { return "avx2"; } break;
+    case GearScanner::COUNT:  { } break;
+    }
+    return "?";
+}
+
+// Bytes before from that still affect the hash at from
+static constexpr usize GEAR_WINDOW = 64;
+
+// First i in [from, to) where the gear hash of data[hash_start..i] has no mask bits set, to if there is none
+static usize gear_scan_scalar(const u8* data, usize hash_start, usize from, usize to, u64 mask) {
+    u64 h = 0;
+    usize i = from - min(from - hash_start, GEAR_WINDOW);
+    for (; i < from; ++i) {
+        h = (h << 1) + GEAR.values[data[i]];
+    }
+    for (; i < to; ++i) {
+        h = (h << 1) + GEAR.values[data[i]];
+        if ((h & mask) == 0) {
+            return i;
+        }
+    }
+    return to;
+}
+
+#ifdef CHUNKER_X86
+
+static constexpr usize GEAR_LANES = 4;
+static constexpr usize GEAR_STRIPE = 256;
+
+typedef u64 u64x4 __attribute__((vector_size(32)));
+typedef long long i64x4 __attribute__((vector_size(32)));
+
+// Same result as gear_scan_scalar(). Blocks of GEAR_LANES consecutive stripes are hashed in lockstep, one stripe per
+// vector lane, and the whole block tested for a hit with one vptest. Once some lane hits, the lanes before it
+// finish their stripes one by one, since one of them may still hit first.
+CHUNKER_TARGET("avx2")
+static usize gear_scan_avx2(const u8* data, usize hash_start, usize from, usize to, u64 mask) {
+    const u64* gear = GEAR.values;
+    const u64x4 m = { mask, mask, mask, mask };
+    const u64x4 zero = { 0, 0, 0, 0 };
+    while (to - from >= GEAR_LANES * GEAR_STRIPE) {
+        const u8* s0 = &data[from];
+        const u8* s1 = s0 + GEAR_STRIPE;
+        const u8* s2 = s1 + GEAR_STRIPE;
+        const u8* s3 = s2 + GEAR_STRIPE;
+
+        // Lane 0 warms up from hash_start like the scalar scan, the others on the tail of the previous stripe
+        u64x4 h = zero;
+        for (usize i = GEAR_STRIPE - GEAR_WINDOW; i < GEAR_STRIPE; ++i) {
+            const u64x4 g = { 0, gear[s0[i]], gear[s1[i]], gear[s2[i]] };
+            h = (h << 1) + g;
+        }
+        h[0] = 0;
+        for (usize i = from - min(from - hash_start, GEAR_WINDOW); i < from; ++i) {
+            h[0] = (h[0] << 1) + gear[data[i]];
+        }
+
+        usize i = 0;
+        for (; i < GEAR_STRIPE; ++i) {
+            const u64x4 g = { gear[s0[i]], gear[s1[i]], gear[s2[i]], gear[s3[i]] };
+            h = (h << 1) + g;
+            const i64x4 hit = (i64x4)((h & m) == zero);
+            if (!_mm256_testz_si256((__m256i)hit, (__m256i)hit)) {
+                break;
+            }
+        }
+        if (i < GEAR_STRIPE) {
+            usize hit = 0;
+            while ((h[hit] & mask) != 0) {
+                ++hit;
+            }
+            for (usize l = 0; l < hit; ++l) {
+                const usize base = from + l * GEAR_STRIPE;
+                u64 hl = h[l];
+                for (usize k = i + 1; k < GEAR_STRIPE; ++k) {
+                    hl = (hl << 1) + gear[data[base + k]];
+                    if ((hl & mask) == 0) {
+                        return base + k;
+                    }
+                }
+            }
+            return from + hit * GEAR_STRIPE + i;
+        }
+        from += GEAR_LANES * GEAR_STRIPE;
+    }
+    return gear_scan_scalar(data, hash_start, from, to, mask);
+}
+
+#endif // CHUNKER_X86
+
+bool gear_scanner_supported(GearScanner scanner) {
+    switch (scanner) {
+    case GearScanner::SCALAR: { return true; } break;
+#ifdef CHUNKER_X86
+    case GearScanner::AVX2:   { return __builtin_cpu_supports("avx2"); } break;
+#endif
+    default: break;
+    }
+    return false;
+}
+
+GearScanner gear_best_scanner() {
+    static const GearScanner best = gear_scanner_supported(GearScanner::AVX2) ? GearScanner::AVX2 : GearScanner::SCALAR;
+    return best;
+}
+
+usize chunk_boundary(const ChunkParams& params, Span<const u8> data, GearScanner scanner) {
+    HK_ASSERT(chunk_params_valid(params));
+    if (data.size() <= params.min_size) {
+        return data.size();
+    }
+
+    u32 bits = 0;
+    while (((usize)1 << bits) < params.avg_size) {
+        bits += 1;
+    }
+    const u64 mask_small = gear_mask(bits + GEAR_NORMALIZATION);
+    const u64 mask_large = gear_mask(bits > GEAR_NORMALIZATION ? bits - GEAR_NORMALIZATION : 1);
+
+    HK_ASSERT(gear_scanner_supported(scanner));
+    usize (*scan)(const u8*, usize, usize, usize, u64) = gear_scan_scalar;
+#ifdef CHUNKER_X86
+    if (scanner == GearScanner::AVX2) {
+        scan = gear_scan_avx2;
+    }
+#endif
+    const usize end = min(data.size(), params.max_size);
+    const usize normal = min(end, params.avg_size);
+    usize cut = scan(data.data(), params.min_size, params.min_size, normal, mask_small);
+    if (cut < normal) {
+        return cut + 1;
+    }
+    cut = scan(data.data(), params.min_size, normal, end, mask_large);
+    if (cut < end) {
+        return cut + 1;
+    }
+    return end;
+}
+
+Chunker::Chunker(const ChunkParams& params) : params(params), start(0) {
+    HK_ASSERT(chunk_params_valid(params));
+}
+
+void Chunker::update(Span<const u8> data, const ChunkFn& fn) {
+    buffer.insert(buffer.end(), data.begin(), data.end());
+    // A boundary is only final once max_size bytes are buffered, any fewer and more data could move it
+    while (buffer.size() - start >= params.max_size) {
+        const Span<const u8> rest = Span<const u8>(&buffer[start], buffer.size() - start);
+        const usize len = chunk_boundary(params, rest);
+        fn(rest.subspan(0, len));
+        start += len;
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + start);
+    start = 0;
+}
+
+void Chunker::finish(const ChunkFn& fn) {
+    while (start < buffer.size()) {
+        const Span<const u8> rest = Span<const u8>(&buffer[start], buffer.size() - start);
+        const usize len = chunk_boundary(params, rest);
+        fn(rest.subspan(0, len));
+        start += len;
+    }
+    buffer.clear();
+    start = 0;
+}
+
+bool chunk_file(const char* path, const ChunkParams& params, HashAlgo algo, std::vector<ChunkInfo>* chunks) {
+    std::FILE* f = std::fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    Chunker chunker = Chunker(params);
+    const Chunker::ChunkFn emit = [algo, chunks](Span<const u8> chunk) {
+        chunks->push_back({ Hasher::hash(algo, chunk), (u32)chunk.size() });
+    };
+
+    std::vector<u8> buf = std::vector<u8>(READ_CHUNK_SIZE);
+    usize n = 0;
+    while ((n = std::fread(buf.data(), 1, buf.size(), f)) > 0) {
+        chunker.update(Span<const u8>(buf.data(), n), emit);
+    }
+    const bool ok = !std::ferror(f);
+    std::fclose(f);
+
+    chunker.finish(emit);
+    return ok;
+}
+
+// ==============================
+// Chunk index
+// ==============================
+
+static const char CHUNK_INDEX_MAGIC[4] = { 'H', 'K', 'C', 'I' };
+
+static bool entry_less(const ChunkIndex::Entry& left, const ChunkIndex::Entry& right) {
+    return memcmp(left.digest, right.digest, sizeof(left.digest)) < 0;
+}
+
+static bool entry_same(const ChunkIndex::Entry& left, const ChunkIndex::Entry& right) {
+    return memcmp(left.digest, right.digest, sizeof(left.digest)) == 0;
+}
+
+bool ChunkIndex::open(const char* path, HashAlgo algo) {
+    this->path.clear();
+    this->algo = algo;
+    entries.clear();
+
+    std::FILE* f = std::fopen(path, "rb");
+    if (f == nullptr) {
+        this->path = path;
+        return true;
+    }
+
+    // The count must match the file's size before anything is allocated for it
+    std::error_code ec;
+    const u64 file_size = (u64)std::filesystem::file_size(path, ec);
+    Header header = Header();
+    bool ok = !ec && std::fread(&header, sizeof(header), 1, f) == 1 &&
+        memcmp(header.magic, CHUNK_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == VERSION && header.algo == (u8)algo &&
+        header.count == (file_size - sizeof(Header)) / sizeof(Entry) &&
+        file_size == sizeof(Header) + header.count * sizeof(Entry);
+    if (ok) {
+        entries.resize(header.count);
+        ok = header.count == 0 || std::fread(entries.data(), sizeof(Entry), header.count, f) == header.count;
+        ok = ok && std::fgetc(f) == EOF;
+    }
+    std::fclose(f);
+
+    if (!ok) {
+        entries.clear();
+        return false;
+    }
+    this->path = path;
+    return true;
+}
+
+void ChunkIndex::add(Span<const ChunkInfo> chunks) {
+    std::lock_guard<std::mutex> lk(lock);
+    for (const ChunkInfo& c : chunks) {
+        Entry e = Entry();
+        memcpy(e.digest, c.digest.bytes, c.digest.size);
+        e.size = c.size;
+        e.refs = 1;
+        pending.push_back(e);
+    }
+}
+
+ChunkIndex::Stats ChunkIndex::merge() {
+    std::lock_guard<std::mutex> lk(lock);
+    Stats stats = Stats();
+
+    std::sort(pending.begin(), pending.end(), entry_less);
+    std::vector<Entry> merged = std::vector<Entry>();
+    merged.reserve(entries.size() + pending.size());
+    usize i = 0;
+    usize j = 0;
+    while (i < entries.size() || j < pending.size()) {
+        if (j == pending.size() || (i < entries.size() && entry_less(entries[i], pending[j]))) {
+            merged.push_back(entries[i++]);
+            continue;
+        }
+
+        usize k = j + 1;
+        while (k < pending.size() && entry_same(pending[k], pending[j])) {
+            ++k;
+        }
+        const u64 refs = k - j;
+        const u64 size = pending[j].size;
+        stats.chunks += refs;
+        stats.bytes += refs * size;
+
+        if (i < entries.size() && entry_same(entries[i], pending[j])) {
+            stats.shared_bytes += refs * size;
+            merged.push_back(entries[i++]);
+        } else {
+            stats.unique_chunks += 1;
+            stats.unique_bytes += size;
+            stats.shared_bytes += (refs - 1) * size;
+            merged.push_back(pending[j]);
+            merged.back().refs = 0;
+        }
+        merged.back().refs = (u32)min<u64>(0xFFFFFFFF, merged.back().refs + refs);
+        j = k;
+    }
+
+    entries = std::move(merged);
+    pending.clear();
+    return stats;
+}
+
+bool ChunkIndex::save() {
+    if (path.empty()) {
+        return false;
+    }
+    merge();
+
+    Header header = Header();
+    memcpy(header.magic, CHUNK_INDEX_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.algo = (u8)algo;
+    header.count = entries.size();
+
+    // Same as HashCache::save(), a crash never leaves a torn index behind
+    const std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+    if (!entries.empty()) {
+        ok = ok && std::fwrite(entries.data(), sizeof(Entry), entries.size(), f) == entries.size();
+    }
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef _FUN_CHUNKER_HH_
+#define _FUN_CHUNKER_HH_
+
+#include "hk.hh"
+#include "hash.hh"
+
+#include <functional>
+#include <mutex>
+
+namespace hk {
+
+// ==============================
+// Content-defined chunking
+// ==============================
+
+// FastCDC: a gear rolling hash (h = (h << 1) + GEAR[byte]) cuts wherever its top bits are all zero, so chunk
+// boundaries depend on content only and survive insertions and deletions elsewhere in the file. Nothing is hashed
+// in the first min_size bytes of a chunk, a stricter mask is used up to avg_size and a looser one after it
+// (normalized chunking, which narrows the size distribution), and chunks are cut at max_size regardless.
+//
+// https://www.usenix.org/conference/atc16/technical-sessions/presentation/xia
+struct ChunkParams {
+    usize min_size;
+    usize avg_size;
+    usize max_size;
+};
+
+constexpr ChunkParams DEFAULT_CHUNK_PARAMS = { 2 * 1024, 8 * 1024, 64 * 1024 };
+
+// avg_size must be a power of two, min_size <= avg_size <= max_size
+bool chunk_params_valid(const ChunkParams& params);
+
+// Every bit of the gear hash depends only on the last 64 bytes, so the boundary scan can hash several stripes of
+// the data side by side in vector lanes, each warmed up on the 64 bytes before it. All scanners find exactly the
+// same boundaries.
+enum class GearScanner : u8 {
+    SCALAR,
+    AVX2,
+    COUNT
+};
+
+const char* gear_scanner_name(GearScanner scanner);
+bool gear_scanner_supported(GearScanner scanner);
+GearScanner gear_best_scanner();
+
+// Length of the first chunk of data (all of it if no boundary is found and it's no longer than max_size)
+usize chunk_boundary(const ChunkParams& params, Span<const u8> data, GearScanner scanner = gear_best_scanner());
+
+// Streaming chunker. Bytes are buffered until a boundary is certain, at most max_size of them.
+class Chunker {
+public:
+    using ChunkFn = std::function<void(Span<const u8> chunk)>;
+private:
+    ChunkParams params;
+    std::vector<u8> buffer;
+    usize start;
+public:
+    explicit Chunker(const ChunkParams& params = DEFAULT_CHUNK_PARAMS);
+
+    void update(Span<const u8> data, const ChunkFn& fn);
+    // Emits whatever is left as the last chunk
+    void finish(const ChunkFn& fn);
+};
+
+struct ChunkInfo {
+    HashDigest digest;
+    u32 size;
+};
+
+// Streams the file through a Chunker and hashes every chunk
+bool chunk_file(const char* path, const ChunkParams& params, HashAlgo algo, std::vector<ChunkInfo>* chunks);
+
+// ==============================
+// Chunk index
+// ==============================
+
+// Every distinct chunk seen so far with its reference count. On disk it's a header followed by fixed-size entries
+// sorted by digest, native-endian like HashCache. Loaded whole, merged in memory and atomically replaced on save().
+//
+// add() may be called from any thread.
+class ChunkIndex {
+public:
+    struct Entry {
+        u8 digest[MAX_DIGEST_SIZE];
+        u32 size;
+        u32 refs;
+    };
+
+    struct Header {
+        char magic[4];
+        u32 version;
+        u8 algo;
+        u8 reserved[7];
+        u64 count;
+    };
+
+    static constexpr u32 VERSION = 1;
+
+    // Bytes of the chunks added since open(), by whether their content was new or already present
+    struct Stats {
+        u64 chunks;
+        u64 bytes;
+        u64 unique_chunks;
+        u64 unique_bytes;
+        u64 shared_bytes;
+    };
+private:
+    std::string path;
+    HashAlgo algo;
+    std::vector<Entry> entries;
+
+    std::mutex lock;
+    std::vector<Entry> pending;
+public:
+    ChunkIndex() : algo(HashAlgo::MD5) { }
+
+    ChunkIndex(const ChunkIndex&) = delete;
+    ChunkIndex& operator=(const ChunkIndex&) = delete;
+
+    // A missing file starts an empty index. False if the file isn't a valid index or was built with another
+    // algorithm.
+    bool open(const char* path, HashAlgo algo);
+    bool save();
+
+    void add(Span<const ChunkInfo> chunks);
+
+    // Folds pending chunks into the table and counts which ones were new. Sharing is counted both against the
+    // loaded index and within what was added.
+    Stats merge();
+
+    usize size() const {
+        return entries.size();
+    }
+};
+
+}
+
+#endif // _FUN_CHUNKER_HH_
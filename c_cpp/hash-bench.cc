@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: MIT
+
+// Conformance checks and throughput benchmarks for every hash implementation in hash.hh.
+//
+// https://www.rfc-editor.org/rfc/rfc1321 (MD5 test suite, appendix A.5)
+// https://www.rfc-editor.org/rfc/rfc6234 (SHA-256 test vectors, section 8.5)
+
+#include "hk.hh"
+#include "hash.hh"
+
+#include <chrono>
+#include <functional>
+
+using namespace hk;
+
+static f64 seconds() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: hash-bench [options]\n"
+        "\n"
+        "Options:\n"
+        "  --check           Only run the conformance checks\n"
+        "  --max-size <n>    Largest benchmarked message size in bytes (default: 1 GiB)\n");
+}
+
+//
+// Implementations
+//
+
+// Every implementation hashes a batch of messages, so single-stream and multi-buffer ones are measured the same way
+struct Impl {
+    const char* name;
+    HashAlgo algo;
+    std::function<void(Span<const Span<const u8>> messages, HashDigest* digests)> run;
+};
+
+// Streams data through a raw compression function, for kernels that aren't what Md5/Sha256 pick by default
+template <usize WORDS, typename F>
+static HashDigest block_hash(Span<const u8> data, const u32 (&iv)[WORDS], bool big_endian, F compress) {
+    u32 state[WORDS];
+    memcpy(state, iv, sizeof(state));
+
+    BlockBuffer buffer = BlockBuffer();
+    auto fn = [&](const u8* blocks, usize count) { compress(state, blocks, count); };
+    buffer.update(data, fn);
+    buffer.finalize(big_endian, fn);
+
+    HashDigest digest = HashDigest();
+    digest.size = WORDS * 4;
+    for (usize i = 0; i < WORDS * 4; ++i) {
+        const usize shift = big_endian ? (24 - (i % 4) * 8) : ((i % 4) * 8);
+        digest.bytes[i] = (u8)(state[i / 4] >> shift);
+    }
+    return digest;
+}
+
+static std::vector<Impl> implementations() {
+    static const u32 MD5_IV[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    static const u32 SHA256_IV[8] = {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+    };
+
+    std::vector<Impl> impls = std::vector<Impl>();
+
+    impls.push_back({ "md5 (reference loop)", HashAlgo::MD5, [](Span<const Span<const u8>> messages, HashDigest* digests) {
+        for (usize i = 0; i < messages.size(); ++i) {
+            digests[i] = block_hash(messages[i], MD5_IV, false, md5_compress_reference);
+        }
+    }});
+    impls.push_back({ "md5 (unrolled)", HashAlgo::MD5, [](Span<const Span<const u8>> messages, HashDigest* digests) {
+        for (usize i = 0; i < messages.size(); ++i) {
+            digests[i] = Hasher::hash(HashAlgo::MD5, messages[i]);
+        }
+    }});
+
+    static const char* MD5_MULTI_NAMES[] = { "md5 (multi-buffer x4)", "md5 (multi-buffer x8)", "md5 (multi-buffer x16)" };
+    static const usize MD5_MULTI_LANES[] = { 4, 8, 16 };
+    for (usize k = 0; k < arrlen(MD5_MULTI_LANES); ++k) {
+        const usize lanes = MD5_MULTI_LANES[k];
+        if (!md5_multi_supported(lanes)) {
+            continue;
+        }
+        impls.push_back({ MD5_MULTI_NAMES[k], HashAlgo::MD5, [lanes](Span<const Span<const u8>> messages, HashDigest* digests) {
+            std::vector<Md5::Digest> out = std::vector<Md5::Digest>(messages.size());
+            md5_multi(messages, out.data(), lanes);
+            for (usize i = 0; i < messages.size(); ++i) {
+                memcpy(digests[i].bytes, out[i].bytes, Md5::DIGEST_SIZE);
+                digests[i].size = Md5::DIGEST_SIZE;
+            }
+        }});
+    }
+
+    static const char* SHA256_NAMES[] = { "sha256 (scalar)", "sha256 (sse4)", "sha256 (avx2)", "sha256 (sha-ni)" };
+    static_assert(arrlen(SHA256_NAMES) == (usize)Sha256Kernel::COUNT, "");
+    for (usize k = 0; k < (usize)Sha256Kernel::COUNT; ++k) {
+        const Sha256Kernel kernel = (Sha256Kernel)k;
+        if (!sha256_kernel_supported(kernel)) {
+            continue;
+        }
+        impls.push_back({ SHA256_NAMES[k], HashAlgo::SHA256, [kernel](Span<const Span<const u8>> messages, HashDigest* digests) {
+            for (usize i = 0; i < messages.size(); ++i) {
+                digests[i] = block_hash(messages[i], SHA256_IV, true, [kernel](u32* state, const u8* blocks, usize count) {
+                    sha256_compress(kernel, state, blocks, count);
+                });
+            }
+        }});
+    }
+
+    return impls;
+}
+
+//
+// Conformance
+//
+
+struct TestVector {
+    HashAlgo algo;
+    const char* input;
+    usize repeat;
+    const char* digest;
+};
+
+static const TestVector TEST_VECTORS[] = {
+    { HashAlgo::MD5, "", 1, "d41d8cd98f00b204e9800998ecf8427e" },
+    { HashAlgo::MD5, "a", 1, "0cc175b9c0f1b6a831c399e269772661" },
+    { HashAlgo::MD5, "abc", 1, "900150983cd24fb0d6963f7d28e17f72" },
+    { HashAlgo::MD5, "message digest", 1, "f96b697d7cb7938d525a2f31aaf161d0" },
+    { HashAlgo::MD5, "abcdefghijklmnopqrstuvwxyz", 1, "c3fcd3d76192e4007dfb496cca67e13b" },
+    { HashAlgo::MD5, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 1, "d174ab98d277d9f5a5611c2c9f419d9f" },
+    { HashAlgo::MD5, "1234567890", 8, "57edf4a22be3c955ac49da2e2107b67a" },
+    { HashAlgo::SHA256, "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { HashAlgo::SHA256, "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { HashAlgo::SHA256, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { HashAlgo::SHA256, "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+        "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+    { HashAlgo::SHA256, "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+    { HashAlgo::SHA256, "0123456701234567012345670123456701234567012345670123456701234567", 10,
+        "594847328451bdfa85056225462cc1d867d877fb388df0ce35f25ab5562bfbb5" },
+};
+
+static u32 check_vectors(const std::vector<Impl>& impls) {
+    u32 failures = 0;
+    for (const TestVector& v : TEST_VECTORS) {
+        std::string input = std::string();
+        for (usize i = 0; i < v.repeat; ++i) {
+            input += v.input;
+        }
+        const Span<const u8> message = Span<const u8>((const u8*)input.data(), input.size());
+
+        for (const Impl& impl : impls) {
+            if (impl.algo != v.algo) {
+                continue;
+            }
+            HashDigest digest = HashDigest();
+            impl.run(Span<const Span<const u8>>(&message, 1), &digest);
+            if (to_hex(digest) != v.digest) {
+                dbglog("  FAIL %s(\"%.16s\" x%u) = %s, expected %s",
+                    impl.name, v.input, (u32)v.repeat, to_hex(digest).c_str(), v.digest);
+                failures += 1;
+            }
+        }
+    }
+    return failures;
+}
+
+// Random messages through every implementation and through the streaming contexts with random update() splits,
+// compared against the first implementation of each algorithm
+static u32 check_random(const std::vector<Impl>& impls, RandomXOR* rng) {
+    constexpr usize MESSAGES = 500;
+    constexpr usize MAX_LENGTH = 5000;
+
+    std::vector<std::vector<u8>> data = std::vector<std::vector<u8>>(MESSAGES);
+    for (auto& d : data) {
+        d.resize(rng->next() % MAX_LENGTH);
+        for (u8& b : d) {
+            b = (u8)rng->next();
+        }
+    }
+    const std::vector<Span<const u8>> messages = std::vector<Span<const u8>>(data.begin(), data.end());
+
+    u32 failures = 0;
+    for (HashAlgo algo : { HashAlgo::MD5, HashAlgo::SHA256 }) {
+        std::vector<HashDigest> expected = std::vector<HashDigest>();
+        for (const Impl& impl : impls) {
+            if (impl.algo != algo) {
+                continue;
+            }
+            std::vector<HashDigest> digests = std::vector<HashDigest>(MESSAGES);
+            impl.run(messages, digests.data());
+            if (expected.empty()) {
+                expected = digests;
+                continue;
+            }
+            for (usize i = 0; i < MESSAGES; ++i) {
+                if (to_hex(digests[i]) != to_hex(expected[i])) {
+                    dbglog("  FAIL %s disagrees on a %u byte message", impl.name, (u32)messages[i].size());
+                    failures += 1;
+                }
+            }
+        }
+
+        for (usize i = 0; i < MESSAGES; ++i) {
+            Hasher hasher = Hasher(algo);
+            Span<const u8> rest = messages[i];
+            while (!rest.empty()) {
+                const usize n = min<usize>(rest.size(), rng->next() % 200);
+                hasher.update(rest.subspan(0, n));
+                rest = rest.subspan(n);
+            }
+            if (to_hex(hasher.finalize()) != to_hex(expected[i])) {
+                dbglog("  FAIL %s streaming disagrees on a %u byte message", hash_algo_name(algo), (u32)messages[i].size());
+                failures += 1;
+            }
+        }
+    }
+    return failures;
+}
+
+//
+// Benchmarks
+//
+
+// Cold-cache runs walk a pool much larger than the last-level cache, so every message comes from DRAM
+static constexpr usize COLD_POOL_SIZE = 256 * 1024 * 1024;
+// Keep going until a measurement has hashed at least this much, or this many messages
+static constexpr usize TARGET_BYTES = 64 * 1024 * 1024;
+static constexpr usize MAX_MESSAGES = 256 * 1024;
+
+// Seconds per batch, best of up to three runs
+static f64 time_batch(const Impl& impl, Span<const Span<const u8>> messages, std::vector<HashDigest>* digests) {
+    f64 best = 1e30;
+    f64 total = 0;
+    for (usize run = 0; run < 3 && total < 1.0; ++run) {
+        const f64 start = seconds();
+        impl.run(messages, digests->data());
+        const f64 elapsed = seconds() - start;
+        best = min(best, elapsed);
+        total += elapsed;
+    }
+    return best;
+}
+
+static std::string format_size(usize size) {
+    char buf[32];
+    if (size >= (1 << 30) && size % (1 << 30) == 0) {
+        snprintf(buf, sizeof(buf), "%u GiB", (u32)(size >> 30));
+    } else if (size >= (1 << 20) && size % (1 << 20) == 0) {
+        snprintf(buf, sizeof(buf), "%u MiB", (u32)(size >> 20));
+    } else if (size >= (1 << 10) && size % (1 << 10) == 0) {
+        snprintf(buf, sizeof(buf), "%u KiB", (u32)(size >> 10));
+    } else {
+        snprintf(buf, sizeof(buf), "%u B", (u32)size);
+    }
+    return buf;
+}
+
+static void benchmark(const std::vector<Impl>& impls, usize max_size) {
+    static const usize SIZES[] = {
+        0, 64, 1 << 10, 16 << 10, 256 << 10, 4 << 20, 64 << 20, 1 << 30,
+    };
+
+    std::vector<u8> pool = std::vector<u8>(max(COLD_POOL_SIZE, max_size));
+    RandomXOR rng = RandomXOR();
+    for (usize i = 0; i < pool.size(); i += 4) {
+        const u32 v = rng.next();
+        memcpy(&pool[i], &v, min<usize>(4, pool.size() - i));
+    }
+
+    dbglog("%-10s %-22s %12s %12s %12s", "size", "implementation", "hot GB/s", "cold GB/s", "hot ns/msg");
+    for (usize size : SIZES) {
+        if (size > max_size) {
+            break;
+        }
+
+        // Hot: the same message over and over. Cold: consecutive messages 4 KiB-aligned through the pool.
+        // Messages bigger than the cold pool's slack can't stay cache-resident anyway, so those only run hot, as
+        // do empty ones.
+        const usize count = clamp<usize>(TARGET_BYTES / max<usize>(size, 1), 1, MAX_MESSAGES);
+        const usize stride = (size + 4095) & ~(usize)4095;
+        const bool has_cold = size > 0 && size * 4 <= COLD_POOL_SIZE;
+
+        std::vector<Span<const u8>> hot = std::vector<Span<const u8>>(count, Span<const u8>(pool.data(), size));
+        std::vector<Span<const u8>> cold = std::vector<Span<const u8>>();
+        if (has_cold) {
+            const usize slots = max<usize>(1, COLD_POOL_SIZE / max<usize>(stride, 64));
+            for (usize i = 0; i < count; ++i) {
+                cold.push_back(Span<const u8>(&pool[(i % slots) * max<usize>(stride, 64)], size));
+            }
+        }
+        std::vector<HashDigest> digests = std::vector<HashDigest>(count);
+
+        for (const Impl& impl : impls) {
+            const f64 hot_time = time_batch(impl, hot, &digests);
+            const f64 bytes = (f64)size * (f64)count;
+            char cold_col[32] = "-";
+            if (has_cold) {
+                snprintf(cold_col, sizeof(cold_col), "%.2f", bytes / time_batch(impl, cold, &digests) / 1e9);
+            }
+            dbglog("%-10s %-22s %12.2f %12s %12.0f",
+                format_size(size).c_str(), impl.name, bytes / hot_time / 1e9, cold_col, hot_time / count * 1e9);
+        }
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    bool check_only = false;
+    usize max_size = 1 << 30;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--check") == 0) {
+            check_only = true;
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = (usize)strtoull(argv[++i], nullptr, 0);
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::vector<Impl> impls = implementations();
+    dbglog("Implementations (%u MD5 lanes, best SHA-256 kernel: %s):",
+        (u32)md5_multi_lanes(), sha256_kernel_name(sha256_best_kernel()));
+    for (const Impl& impl : impls) {
+        dbglog("  %s", impl.name);
+    }
+
+    RandomXOR rng = RandomXOR();
+    const u32 vector_failures = check_vectors(impls);
+    dbglog("Test vectors: %s", vector_failures ? "FAILED" : "ok");
+    const u32 random_failures = check_random(impls, &rng);
+    dbglog("Randomized cross-checks: %s", random_failures ? "FAILED" : "ok");
+    if (vector_failures || random_failures) {
+        return EXIT_FAILURE;
+    }
+
+    if (!check_only) {
+        benchmark(impls, max_size);
+    }
+
+    return EXIT_SUCCESS;
+}
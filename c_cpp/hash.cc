@@ -0,0 +1,847 @@
+// SPDX-License-Identifier: MIT
+
+// https://en.wikipedia.org/wiki/MD5
+// https://github.com/B-Con/crypto-algorithms/blob/master/md5.c
+// https://en.wikipedia.org/wiki/SHA-2
+// https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+
+#include "hash.hh"
+
+#include <utility> // std::integer_sequence
+
+#if defined(HK_GCC) && (defined(__x86_64__) || defined(__i386__))
+#   define HASH_X86
+#   include <cpuid.h>
+#   include <immintrin.h>
+#endif
+
+#ifdef HK_GCC
+#   define HASH_INLINE inline __attribute__((always_inline))
+#   define HASH_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER)
+#   define HASH_INLINE __forceinline
+#   define HASH_TARGET(isa)
+#else
+#   define HASH_INLINE inline
+#   define HASH_TARGET(isa)
+#endif
+
+namespace hk {
+
+static inline u32 load_le32(const u8* p) {
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static inline void store_le32(u8* p, u32 v) {
+    p[0] = (u8)(v >>  0);
+    p[1] = (u8)(v >>  8);
+    p[2] = (u8)(v >> 16);
+    p[3] = (u8)(v >> 24);
+}
+
+static inline u32 load_be32(const u8* p) {
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+static inline void store_be32(u8* p, u32 v) {
+    p[0] = (u8)(v >> 24);
+    p[1] = (u8)(v >> 16);
+    p[2] = (u8)(v >>  8);
+    p[3] = (u8)(v >>  0);
+}
+
+// ==============================
+// MD5
+// ==============================
+
+static constexpr u32 MD5_SHIFT_TABLE[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static constexpr u32 MD5_SIN_TABLE[64] = {
+    0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE,
+    0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+    0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE,
+    0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+    0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA,
+    0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+    0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED,
+    0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+    0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C,
+    0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+    0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05,
+    0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+    0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039,
+    0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+    0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1,
+    0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+};
+
+// Step J of the compression function. Everything that depends on J (round function, message index, shift and
+// constant) is resolved at compile time, so the unrolled sequence has no branches or table lookups. V is either
+// u32 or a vector of u32 lanes.
+template <u32 J, typename V>
+static HASH_INLINE void md5_step(V& a, V& b, V& c, V& d, const V* m) {
+    constexpr u32 ROUND = J / 16;
+    constexpr u32 G = (ROUND == 0) ? J : (ROUND == 1) ? (J * 5 + 1) % 16 : (ROUND == 2) ? (J * 3 + 5) % 16 : (J * 7) % 16;
+    constexpr u32 S = MD5_SHIFT_TABLE[J];
+
+    // https://en.wikipedia.org/wiki/MD5#Algorithm
+    V f;
+    if constexpr (ROUND == 0) {
+        f = (b & c) | (~b & d);
+    } else if constexpr (ROUND == 1) {
+        f = (b & d) | (c & ~d);
+    } else if constexpr (ROUND == 2) {
+        f = b ^ c ^ d;
+    } else {
+        f = c ^ (b | ~d);
+    }
+
+    const V t = f + a + MD5_SIN_TABLE[J] + m[G];
+    a = d;
+    d = c;
+    c = b;
+    b = b + ((t << S) | (t >> (32 - S)));
+}
+
+template <typename V, u32... J>
+static HASH_INLINE void md5_steps(V s[4], const V* m, std::integer_sequence<u32, J...>) {
+    V a = s[0];
+    V b = s[1];
+    V c = s[2];
+    V d = s[3];
+
+    (md5_step<J>(a, b, c, d, m), ...);
+
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+}
+
+void md5_compress(u32 state[4], const u8* blocks, usize count) {
+    for (usize i = 0; i < count; ++i) {
+        const u8* block = &blocks[i * Md5::BLOCK_SIZE];
+
+        u32 m[16];
+        for (usize j = 0; j < 16; ++j) {
+            m[j] = load_le32(&block[j * 4]);
+        }
+
+        md5_steps(state, m, std::make_integer_sequence<u32, 64>());
+    }
+}
+
+void md5_compress_reference(u32 state[4], const u8* blocks, usize count) {
+    for (usize i = 0; i < count; ++i) {
+        const u8* block = &blocks[i * Md5::BLOCK_SIZE];
+
+        u32 m[16];
+        for (usize j = 0; j < 16; ++j) {
+            m[j] = load_le32(&block[j * 4]);
+        }
+
+        u32 a = state[0];
+        u32 b = state[1];
+        u32 c = state[2];
+        u32 d = state[3];
+
+        // https://en.wikipedia.org/wiki/MD5#Algorithm
+        #define F(b, c, d) ((b & c) | (~b & d))
+        #define G(b, c, d) ((b & d) | (c & ~d))
+        #define H(b, c, d) (b ^ c ^ d)
+        #define I(b, c, d) (c ^ (b | ~d))
+
+        for (u32 j = 0; j < 64; ++j) {
+            u32 f = 0;
+            u32 g = 0;
+            if (j < 16) {
+                f = F(b, c, d);
+                g = j;
+            }
+            else if (j < 32) {
+                f = G(b, c, d);
+                g = (j * 5 + 1) % 16;
+            }
+            else if (j < 48) {
+                f = H(b, c, d);
+                g = (j * 3 + 5) % 16;
+            }
+            else {
+                f = I(b, c, d);
+                g = (j * 7) % 16;
+            }
+            f = f + a + MD5_SIN_TABLE[j] + m[g];
+            a = d;
+            d = c;
+            c = b;
+            b = b + rotate_left(f, MD5_SHIFT_TABLE[j]);
+        }
+
+        #undef I
+        #undef H
+        #undef G
+        #undef F
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+}
+
+void Md5::reset() {
+    state[0] = 0x67452301;
+    state[1] = 0xEFCDAB89;
+    state[2] = 0x98BADCFE;
+    state[3] = 0x10325476;
+    buffer.reset();
+}
+
+void Md5::update(Span<const u8> data) {
+    buffer.update(data, [this](const u8* blocks, usize count) {
+        md5_compress(state, blocks, count);
+    });
+}
+
+Md5::Digest Md5::finalize() {
+    buffer.finalize(false, [this](const u8* blocks, usize count) {
+        md5_compress(state, blocks, count);
+    });
+
+    Digest digest = Digest();
+    for (usize i = 0; i < 4; ++i) {
+        store_le32(&digest.bytes[i * 4], state[i]);
+    }
+
+    reset();
+    return digest;
+}
+
+// ==============================
+// MD5 (multi-buffer)
+// ==============================
+
+// Per-lane message scheduling. A lane walks the whole blocks of its message in place, then the one or two padded
+// tail blocks from its own buffer.
+struct Md5Lane {
+    const u8* data;
+    usize blocks;
+    u8 tail[Md5::BLOCK_SIZE * 2];
+    usize tail_blocks;
+    usize message;
+};
+
+static void md5_lane_assign(Md5Lane* lane, Span<const u8> message, usize index) {
+    const usize whole = message.size() / Md5::BLOCK_SIZE;
+    const usize rest = message.size() - whole * Md5::BLOCK_SIZE;
+    const u64 size_bits = message.size() * 8;
+
+    lane->data = message.data();
+    lane->blocks = whole;
+    lane->tail_blocks = (rest + 1 + sizeof(u64) > Md5::BLOCK_SIZE) ? 2 : 1;
+    lane->message = index;
+
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if (rest > 0) {
+        memcpy(lane->tail, &message[whole * Md5::BLOCK_SIZE], rest);
+    }
+    lane->tail[rest] = 1 << 7;
+    u8* end = &lane->tail[lane->tail_blocks * Md5::BLOCK_SIZE];
+    store_le32(end - 8, (u32)(size_bits >>  0));
+    store_le32(end - 4, (u32)(size_bits >> 32));
+}
+
+static const u8* md5_lane_next_block(Md5Lane* lane, usize* consumed) {
+    const usize i = (*consumed)++;
+    if (i < lane->blocks) {
+        return &lane->data[i * Md5::BLOCK_SIZE];
+    }
+    return &lane->tail[(i - lane->blocks) * Md5::BLOCK_SIZE];
+}
+
+// Refills lanes from messages until all of them are hashed. block(state, m) runs one transposed block for all L lanes.
+template <usize L, typename BlockFn>
+static void md5_multi_run(Span<const Span<const u8>> messages, Md5::Digest* digests, BlockFn block) {
+    static const u32 IV[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    static const u8 IDLE_BLOCK[Md5::BLOCK_SIZE] = { };
+
+    Md5Lane lanes[L];
+    usize consumed[L];
+    bool active[L];
+    alignas(64) u32 state[4 * L];
+    alignas(64) u32 m[16 * L];
+
+    usize next = 0;
+    usize live = 0;
+    for (usize l = 0; l < L; ++l) {
+        active[l] = next < messages.size();
+        if (active[l]) {
+            md5_lane_assign(&lanes[l], messages[next], next);
+            next += 1;
+            live += 1;
+        }
+        consumed[l] = 0;
+        for (usize j = 0; j < 4; ++j) {
+            state[j * L + l] = IV[j];
+        }
+    }
+
+    while (live > 0) {
+        for (usize l = 0; l < L; ++l) {
+            const u8* p = active[l] ? md5_lane_next_block(&lanes[l], &consumed[l]) : IDLE_BLOCK;
+            for (usize j = 0; j < 16; ++j) {
+                m[j * L + l] = load_le32(&p[j * 4]);
+            }
+        }
+
+        block(state, m);
+
+        for (usize l = 0; l < L; ++l) {
+            if (!active[l] || consumed[l] < lanes[l].blocks + lanes[l].tail_blocks) {
+                continue;
+            }
+
+            Md5::Digest* digest = &digests[lanes[l].message];
+            for (usize j = 0; j < 4; ++j) {
+                store_le32(&digest->bytes[j * 4], state[j * L + l]);
+                state[j * L + l] = IV[j];
+            }
+            consumed[l] = 0;
+
+            if (next < messages.size()) {
+                md5_lane_assign(&lanes[l], messages[next], next);
+                next += 1;
+            } else {
+                active[l] = false;
+                live -= 1;
+            }
+        }
+    }
+}
+
+#ifdef HK_GCC
+
+typedef u32 u32x4  __attribute__((vector_size(16)));
+typedef u32 u32x8  __attribute__((vector_size(32)));
+typedef u32 u32x16 __attribute__((vector_size(64)));
+
+// One MD5 block for every lane of V at once. state and m are stored transposed: state[word][lane], m[word][lane].
+template <typename V>
+static HASH_INLINE void md5_lanes_block(u32* state, const u32* m, usize lanes) {
+    V w[16];
+    for (usize j = 0; j < 16; ++j) {
+        memcpy(&w[j], &m[j * lanes], sizeof(V));
+    }
+    V s[4];
+    for (usize j = 0; j < 4; ++j) {
+        memcpy(&s[j], &state[j * lanes], sizeof(V));
+    }
+
+    md5_steps(s, w, std::make_integer_sequence<u32, 64>());
+
+    for (usize j = 0; j < 4; ++j) {
+        memcpy(&state[j * lanes], &s[j], sizeof(V));
+    }
+}
+
+static void md5_multi_x4(Span<const Span<const u8>> messages, Md5::Digest* digests) {
+    md5_multi_run<4>(messages, digests, [](u32* state, const u32* m) {
+        md5_lanes_block<u32x4>(state, m, 4);
+    });
+}
+
+#ifdef HASH_X86
+
+HASH_TARGET("avx2")
+static void md5_lanes_block_x8(u32* state, const u32* m) {
+    md5_lanes_block<u32x8>(state, m, 8);
+}
+
+HASH_TARGET("avx512f")
+static void md5_lanes_block_x16(u32* state, const u32* m) {
+    md5_lanes_block<u32x16>(state, m, 16);
+}
+
+static void md5_multi_x8(Span<const Span<const u8>> messages, Md5::Digest* digests) {
+    md5_multi_run<8>(messages, digests, md5_lanes_block_x8);
+}
+
+static void md5_multi_x16(Span<const Span<const u8>> messages, Md5::Digest* digests) {
+    md5_multi_run<16>(messages, digests, md5_lanes_block_x16);
+}
+
+#endif // HASH_X86
+
+#else
+
+// Scalar stand-in for a vector type, for compilers without GCC vector extensions
+template <usize L>
+struct Md5ScalarLanes {
+    static void block(u32* state, const u32* m) {
+        for (usize l = 0; l < L; ++l) {
+            u32 s[4];
+            u8 block[Md5::BLOCK_SIZE];
+            for (usize j = 0; j < 4; ++j) {
+                s[j] = state[j * L + l];
+            }
+            for (usize j = 0; j < 16; ++j) {
+                store_le32(&block[j * 4], m[j * L + l]);
+            }
+            md5_compress(s, block, 1);
+            for (usize j = 0; j < 4; ++j) {
+                state[j * L + l] = s[j];
+            }
+        }
+    }
+};
+
+static void md5_multi_x4(Span<const Span<const u8>> messages, Md5::Digest* digests) {
+    md5_multi_run<4>(messages, digests, Md5ScalarLanes<4>::block);
+}
+
+#endif // HK_GCC
+
+bool md5_multi_supported(usize lanes) {
+    switch (lanes) {
+    case  4: { return true; } break;
+#ifdef HASH_X86
+    case  8: { return __builtin_cpu_supports("avx2"); } break;
+    case 16: { return __builtin_cpu_supports("avx512f"); } break;
+#endif
+    default: { } break;
+    }
+    return false;
+}
+
+usize md5_multi_lanes() {
+    static const usize lanes = md5_multi_supported(16) ? 16 : md5_multi_supported(8) ? 8 : 4;
+    return lanes;
+}
+
+void md5_multi(Span<const Span<const u8>> messages, Md5::Digest* digests, usize lanes) {
+    HK_ASSERT(md5_multi_supported(lanes));
+    switch (lanes) {
+#ifdef HASH_X86
+    case 16: { md5_multi_x16(messages, digests); } break;
+    case  8: { md5_multi_x8(messages, digests); } break;
+#endif
+    default: { md5_multi_x4(messages, digests); } break;
+    }
+}
+
+void md5_multi(Span<const Span<const u8>> messages, Md5::Digest* digests) {
+    md5_multi(messages, digests, md5_multi_lanes());
+}
+
+// ==============================
+// SHA-256
+// ==============================
+
+static constexpr u32 SHA256_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+alignas(64) static constexpr u32 SHA256_K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static HASH_INLINE u32 rotr32(u32 x, u32 n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// The 64 rounds, given the message schedule with the round constants already added (wk[t] = W[t] + K[t]). Shared
+// by every kernel except SHA-NI, which only differ in how they compute the schedule.
+static HASH_INLINE void sha256_rounds(u32 state[8], const u32 wk[64]) {
+    u32 a = state[0];
+    u32 b = state[1];
+    u32 c = state[2];
+    u32 d = state[3];
+    u32 e = state[4];
+    u32 f = state[5];
+    u32 g = state[6];
+    u32 h = state[7];
+
+    for (usize t = 0; t < 64; ++t) {
+        const u32 s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        const u32 ch = (e & f) ^ (~e & g);
+        const u32 t1 = h + s1 + ch + wk[t];
+        const u32 s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        const u32 maj = (a & b) ^ (a & c) ^ (b & c);
+        const u32 t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void sha256_compress_scalar(u32 state[8], const u8* blocks, usize count) {
+    for (usize i = 0; i < count; ++i) {
+        const u8* block = &blocks[i * Sha256::BLOCK_SIZE];
+
+        u32 w[64];
+        for (usize t = 0; t < 16; ++t) {
+            w[t] = load_be32(&block[t * 4]);
+        }
+        for (usize t = 16; t < 64; ++t) {
+            const u32 s0 = rotr32(w[t - 15], 7) ^ rotr32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            const u32 s1 = rotr32(w[t - 2], 17) ^ rotr32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        for (usize t = 0; t < 64; ++t) {
+            w[t] += SHA256_K[t];
+        }
+
+        sha256_rounds(state, w);
+    }
+}
+
+#ifdef HASH_X86
+
+// Message schedule four words at a time. x0..x3 hold W[t-16..t-1]; returns W[t..t+3]. The s1 term of the upper two
+// words depends on the lower two, so it's computed in two halves.
+HASH_TARGET("ssse3,sse4.1")
+static inline __m128i sha256_schedule_sse4(__m128i x0, __m128i x1, __m128i x2, __m128i x3) {
+    #define ROTR(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n))
+    #define SIGMA0(x) _mm_xor_si128(_mm_xor_si128(ROTR(x, 7), ROTR(x, 18)), _mm_srli_epi32(x, 3))
+    #define SIGMA1(x) _mm_xor_si128(_mm_xor_si128(ROTR(x, 17), ROTR(x, 19)), _mm_srli_epi32(x, 10))
+
+    const __m128i w15 = _mm_alignr_epi8(x1, x0, 4);
+    const __m128i w7 = _mm_alignr_epi8(x3, x2, 4);
+    const __m128i base = _mm_add_epi32(_mm_add_epi32(x0, w7), SIGMA0(w15));
+
+    const __m128i w2 = _mm_shuffle_epi32(x3, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m128i lo = _mm_add_epi32(base, SIGMA1(w2));
+    const __m128i w2_hi = _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m128i hi = _mm_add_epi32(base, SIGMA1(w2_hi));
+
+    #undef SIGMA1
+    #undef SIGMA0
+    #undef ROTR
+
+    return _mm_blend_epi16(lo, hi, 0xF0);
+}
+
+HASH_TARGET("ssse3,sse4.1")
+static void sha256_compress_sse4(u32 state[8], const u8* blocks, usize count) {
+    const __m128i BSWAP = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    for (usize i = 0; i < count; ++i) {
+        const u8* block = &blocks[i * Sha256::BLOCK_SIZE];
+
+        alignas(16) u32 wk[64];
+        __m128i x[4];
+        for (usize j = 0; j < 4; ++j) {
+            x[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&block[j * 16]), BSWAP);
+            _mm_store_si128((__m128i*)&wk[j * 4], _mm_add_epi32(x[j], _mm_load_si128((const __m128i*)&SHA256_K[j * 4])));
+        }
+        for (usize t = 16; t < 64; t += 4) {
+            const __m128i next = sha256_schedule_sse4(x[0], x[1], x[2], x[3]);
+            x[0] = x[1];
+            x[1] = x[2];
+            x[2] = x[3];
+            x[3] = next;
+            _mm_store_si128((__m128i*)&wk[t], _mm_add_epi32(next, _mm_load_si128((const __m128i*)&SHA256_K[t])));
+        }
+
+        sha256_rounds(state, wk);
+    }
+}
+
+// Same schedule as the SSE4 kernel, but with one block in each 128-bit half of a 256-bit register. All the shuffles
+// involved work within 128-bit halves, so two consecutive blocks get their schedules computed for the price of one.
+HASH_TARGET("avx2")
+static inline __m256i sha256_schedule_avx2(__m256i x0, __m256i x1, __m256i x2, __m256i x3) {
+    #define ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n))
+    #define SIGMA0(x) _mm256_xor_si256(_mm256_xor_si256(ROTR(x, 7), ROTR(x, 18)), _mm256_srli_epi32(x, 3))
+    #define SIGMA1(x) _mm256_xor_si256(_mm256_xor_si256(ROTR(x, 17), ROTR(x, 19)), _mm256_srli_epi32(x, 10))
+
+    const __m256i w15 = _mm256_alignr_epi8(x1, x0, 4);
+    const __m256i w7 = _mm256_alignr_epi8(x3, x2, 4);
+    const __m256i base = _mm256_add_epi32(_mm256_add_epi32(x0, w7), SIGMA0(w15));
+
+    const __m256i w2 = _mm256_shuffle_epi32(x3, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256i lo = _mm256_add_epi32(base, SIGMA1(w2));
+    const __m256i w2_hi = _mm256_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256i hi = _mm256_add_epi32(base, SIGMA1(w2_hi));
+
+    #undef SIGMA1
+    #undef SIGMA0
+    #undef ROTR
+
+    return _mm256_blend_epi32(lo, hi, 0xCC);
+}
+
+HASH_TARGET("avx2")
+static void sha256_compress_avx2(u32 state[8], const u8* blocks, usize count) {
+    const __m256i BSWAP = _mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    usize i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const u8* block = &blocks[i * Sha256::BLOCK_SIZE];
+
+        alignas(32) u32 wk[2][64];
+        __m256i x[4];
+        for (usize j = 0; j < 4; ++j) {
+            const __m128i first = _mm_loadu_si128((const __m128i*)&block[j * 16]);
+            const __m128i second = _mm_loadu_si128((const __m128i*)&block[Sha256::BLOCK_SIZE + j * 16]);
+            x[j] = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1), BSWAP);
+        }
+        for (usize t = 0; t < 64; t += 4) {
+            if (t >= 16) {
+                const __m256i next = sha256_schedule_avx2(x[0], x[1], x[2], x[3]);
+                x[0] = x[1];
+                x[1] = x[2];
+                x[2] = x[3];
+                x[3] = next;
+            }
+            const __m256i k = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)&SHA256_K[t]));
+            const __m256i sum = _mm256_add_epi32((t >= 16) ? x[3] : x[t / 4], k);
+            _mm_store_si128((__m128i*)&wk[0][t], _mm256_castsi256_si128(sum));
+            _mm_store_si128((__m128i*)&wk[1][t], _mm256_extracti128_si256(sum, 1));
+        }
+
+        sha256_rounds(state, wk[0]);
+        sha256_rounds(state, wk[1]);
+    }
+
+    if (i < count) {
+        sha256_compress_sse4(state, &blocks[i * Sha256::BLOCK_SIZE], count - i);
+    }
+}
+
+// SHA-NI keeps the state as ABEF/CDGH pairs and does two rounds per sha256rnds2
+HASH_TARGET("sha,ssse3,sse4.1")
+static void sha256_compress_shani(u32 state[8], const u8* blocks, usize count) {
+    const __m128i BSWAP = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    // DCBA, HGFE -> ABEF, CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (usize i = 0; i < count; ++i) {
+        const u8* block = &blocks[i * Sha256::BLOCK_SIZE];
+        const __m128i abef_save = abef;
+        const __m128i cdgh_save = cdgh;
+
+        __m128i w[4];
+        for (usize j = 0; j < 16; ++j) {
+            if (j < 4) {
+                w[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&block[j * 16]), BSWAP);
+            } else {
+                // W[t-16] + s0(W[t-15]) + W[t-7], then + s1(W[t-2])
+                __m128i next = _mm_sha256msg1_epu32(w[j % 4], w[(j + 1) % 4]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(j + 3) % 4], w[(j + 2) % 4], 4));
+                w[j % 4] = _mm_sha256msg2_epu32(next, w[(j + 3) % 4]);
+            }
+
+            __m128i wk = _mm_add_epi32(w[j % 4], _mm_load_si128((const __m128i*)&SHA256_K[j * 4]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+            wk = _mm_shuffle_epi32(wk, 0x0E);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, wk);
+        }
+
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    // ABEF, CDGH -> DCBA, HGFE
+    tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+static bool cpu_has_sha() {
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ebx >> 29) & 1;
+}
+
+#endif // HASH_X86
+
+const char* sha256_kernel_name(Sha256Kernel kernel) {
+    switch (kernel) {
+    case Sha256Kernel::SCALAR: { return "scalar"; } break;
+    case Sha256Kernel::SSE4:   { return "sse4"; } break;
+    case Sha256Kernel::AVX2:   { return "avx2"; } break;
+    case Sha256Kernel::SHANI:  { return "sha-ni"; } break;
+    default: break;
+    }
+    return "?";
+}
+
+static bool sha256_kernel_detect(Sha256Kernel kernel) {
+    switch (kernel) {
+    case Sha256Kernel::SCALAR: { return true; } break;
+#ifdef HASH_X86
+    case Sha256Kernel::SSE4:   { return __builtin_cpu_supports("sse4.1"); } break;
+    case Sha256Kernel::AVX2:   { return __builtin_cpu_supports("avx2"); } break;
+    case Sha256Kernel::SHANI:  { return __builtin_cpu_supports("sse4.1") && cpu_has_sha(); } break;
+#endif
+    default: break;
+    }
+    return false;
+}
+
+bool sha256_kernel_supported(Sha256Kernel kernel) {
+    // cpuid is slow (and traps under some hypervisors), so only ask once
+    static const u8 supported = []() {
+        u8 mask = 0;
+        for (usize k = 0; k < (usize)Sha256Kernel::COUNT; ++k) {
+            mask |= sha256_kernel_detect((Sha256Kernel)k) ? (1 << k) : 0;
+        }
+        return mask;
+    }();
+    return (supported >> (usize)kernel) & 1;
+}
+
+Sha256Kernel sha256_best_kernel() {
+    static const Sha256Kernel best = []() {
+        for (usize k = (usize)Sha256Kernel::COUNT; k-- > 0; ) {
+            if (sha256_kernel_supported((Sha256Kernel)k)) {
+                return (Sha256Kernel)k;
+            }
+        }
+        return Sha256Kernel::SCALAR;
+    }();
+    return best;
+}
+
+void sha256_compress(Sha256Kernel kernel, u32 state[8], const u8* blocks, usize count) {
+    HK_ASSERT(sha256_kernel_supported(kernel));
+    switch (kernel) {
+#ifdef HASH_X86
+    case Sha256Kernel::SSE4:  { sha256_compress_sse4(state, blocks, count); } break;
+    case Sha256Kernel::AVX2:  { sha256_compress_avx2(state, blocks, count); } break;
+    case Sha256Kernel::SHANI: { sha256_compress_shani(state, blocks, count); } break;
+#endif
+    default: { sha256_compress_scalar(state, blocks, count); } break;
+    }
+}
+
+void sha256_compress(u32 state[8], const u8* blocks, usize count) {
+    sha256_compress(sha256_best_kernel(), state, blocks, count);
+}
+
+void Sha256::reset() {
+    memcpy(state, SHA256_IV, sizeof(state));
+    buffer.reset();
+}
+
+void Sha256::update(Span<const u8> data) {
+    buffer.update(data, [this](const u8* blocks, usize count) {
+        sha256_compress(state, blocks, count);
+    });
+}
+
+Sha256::Digest Sha256::finalize() {
+    buffer.finalize(true, [this](const u8* blocks, usize count) {
+        sha256_compress(state, blocks, count);
+    });
+
+    Digest digest = Digest();
+    for (usize i = 0; i < 8; ++i) {
+        store_be32(&digest.bytes[i * 4], state[i]);
+    }
+
+    reset();
+    return digest;
+}
+
+// ==============================
+// Algorithm selection
+// ==============================
+
+const char* hash_algo_name(HashAlgo algo) {
+    switch (algo) {
+    case HashAlgo::MD5:    { return "md5"; } break;
+    case HashAlgo::SHA256: { return "sha256"; } break;
+    }
+    return "?";
+}
+
+bool hash_algo_from_name(const char* name, HashAlgo* algo) {
+    if (str::ieq(name, "md5")) {
+        *algo = HashAlgo::MD5;
+        return true;
+    }
+    if (str::ieq(name, "sha256") || str::ieq(name, "sha-256")) {
+        *algo = HashAlgo::SHA256;
+        return true;
+    }
+    return false;
+}
+
+usize hash_digest_size(HashAlgo algo) {
+    switch (algo) {
+    case HashAlgo::MD5:    { return Md5::DIGEST_SIZE; } break;
+    case HashAlgo::SHA256: { return Sha256::DIGEST_SIZE; } break;
+    }
+    return 0;
+}
+
+void Hasher::update(Span<const u8> data) {
+    switch (algo) {
+    case HashAlgo::MD5:    { md5.update(data); } break;
+    case HashAlgo::SHA256: { sha256.update(data); } break;
+    }
+}
+
+HashDigest Hasher::finalize() {
+    HashDigest digest = HashDigest();
+    digest.size = hash_digest_size(algo);
+    switch (algo) {
+    case HashAlgo::MD5: {
+        const Md5::Digest d = md5.finalize();
+        memcpy(digest.bytes, d.bytes, sizeof(d.bytes));
+    } break;
+    case HashAlgo::SHA256: {
+        const Sha256::Digest d = sha256.finalize();
+        memcpy(digest.bytes, d.bytes, sizeof(d.bytes));
+    } break;
+    }
+    return digest;
+}
+
+}
@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef _FUN_HASH_HH_
+#define _FUN_HASH_HH_
+
+#include "hk.hh"
+
+namespace hk {
+
+// ==============================
+// Block buffering
+// ==============================
+
+// Shared front end for the Merkle-Damgard hashes below (64-byte blocks, "one" bit + zero padding + 64-bit bit
+// count). Only the current partial block is buffered between calls to update(), so memory use is constant no
+// matter how much data is fed through. compress(blocks, count) processes whole blocks.
+class BlockBuffer {
+public:
+    static constexpr usize BLOCK_SIZE = 64;
+private:
+    u8 block[BLOCK_SIZE];
+    usize block_len;
+    u64 total_len;
+public:
+    BlockBuffer() { reset(); }
+
+    void reset() {
+        block_len = 0;
+        total_len = 0;
+    }
+
+    template <typename F>
+    void update(Span<const u8> data, F compress) {
+        const u8* p = data.data();
+        usize n = data.size();
+        total_len += n;
+
+        // Top up a partial block from a previous call first
+        if (block_len > 0) {
+            const usize take = min(n, BLOCK_SIZE - block_len);
+            memcpy(&block[block_len], p, take);
+            block_len += take;
+            p += take;
+            n -= take;
+            if (block_len < BLOCK_SIZE) {
+                return;
+            }
+            compress(block, 1);
+            block_len = 0;
+        }
+
+        // Hash whole blocks straight out of the caller's buffer
+        const usize whole = n / BLOCK_SIZE;
+        if (whole > 0) {
+            compress(p, whole);
+            p += whole * BLOCK_SIZE;
+            n -= whole * BLOCK_SIZE;
+        }
+
+        memcpy(block, p, n);
+        block_len = n;
+    }
+
+    // Data is followed immediately by a "one" bit, then padded with zeroes until the last 8 bytes of the last
+    // block, where the size of the input in bits is written (little-endian for MD5, big-endian for SHA-2).
+    //
+    // https://www.desmos.com/calculator/hypjdhc7v7
+    template <typename F>
+    void finalize(bool big_endian_length, F compress) {
+        const u64 size_bits = total_len * 8;
+
+        block[block_len++] = 1 << 7;
+        if (block_len > BLOCK_SIZE - sizeof(u64)) {
+            memset(&block[block_len], 0, BLOCK_SIZE - block_len);
+            compress(block, 1);
+            block_len = 0;
+        }
+        memset(&block[block_len], 0, BLOCK_SIZE - sizeof(u64) - block_len);
+        for (usize i = 0; i < sizeof(u64); ++i) {
+            const usize shift = big_endian_length ? (56 - i * 8) : (i * 8);
+            block[BLOCK_SIZE - sizeof(u64) + i] = (u8)(size_bits >> shift);
+        }
+        compress(block, 1);
+
+        reset();
+    }
+};
+
+// ==============================
+// MD5
+// ==============================
+
+// Streaming MD5 context
+class Md5 {
+public:
+    static constexpr usize BLOCK_SIZE = BlockBuffer::BLOCK_SIZE;
+    static constexpr usize DIGEST_SIZE = 16;
+
+    struct Digest {
+        u8 bytes[DIGEST_SIZE];
+    };
+private:
+    u32 state[4];
+    BlockBuffer buffer;
+public:
+    Md5() { reset(); }
+
+    void reset();
+    void update(Span<const u8> data);
+    Digest finalize();
+public:
+    static Digest hash(Span<const u8> data) {
+        Md5 md5 = Md5();
+        md5.update(data);
+        return md5.finalize();
+    }
+};
+
+// Process whole 64-byte blocks into state
+void md5_compress(u32 state[4], const u8* blocks, usize count);
+
+// Straightforward looping version of md5_compress(), kept as a baseline for benchmarks and cross-checks
+void md5_compress_reference(u32 state[4], const u8* blocks, usize count);
+
+// Multi-buffer MD5. Hashes many independent messages at once, one per SIMD lane (4 with SSE2, 8 with AVX2, 16
+// with AVX-512, picked at runtime). Whenever a message finishes, its lane is refilled with the next one, so
+// throughput scales with the lane count when there are enough messages to go around.
+void md5_multi(Span<const Span<const u8>> messages, Md5::Digest* digests);
+
+// With a given lane count, 4, 8 or 16, which must be supported. For cross-checks and benchmarks.
+void md5_multi(Span<const Span<const u8>> messages, Md5::Digest* digests, usize lanes);
+bool md5_multi_supported(usize lanes);
+
+// Number of lanes md5_multi() runs with on this machine, the most supported
+usize md5_multi_lanes();
+
+// ==============================
+// SHA-256
+// ==============================
+
+// Streaming SHA-256 context
+class Sha256 {
+public:
+    static constexpr usize BLOCK_SIZE = BlockBuffer::BLOCK_SIZE;
+    static constexpr usize DIGEST_SIZE = 32;
+
+    struct Digest {
+        u8 bytes[DIGEST_SIZE];
+    };
+private:
+    u32 state[8];
+    BlockBuffer buffer;
+public:
+    Sha256() { reset(); }
+
+    void reset();
+    void update(Span<const u8> data);
+    Digest finalize();
+public:
+    static Digest hash(Span<const u8> data) {
+        Sha256 sha = Sha256();
+        sha.update(data);
+        return sha.finalize();
+    }
+};
+
+// SHA-256 compression kernels. sha256_compress() uses the fastest one the CPU supports.
+enum class Sha256Kernel : u8 {
+    SCALAR,
+    SSE4,   // SSE4.1 message schedule, scalar rounds
+    AVX2,   // AVX2 message schedule for two blocks at once, scalar rounds
+    SHANI,  // Intel SHA extensions
+    COUNT,
+};
+
+const char* sha256_kernel_name(Sha256Kernel kernel);
+bool sha256_kernel_supported(Sha256Kernel kernel);
+Sha256Kernel sha256_best_kernel();
+
+// Process whole 64-byte blocks into state
+void sha256_compress(u32 state[8], const u8* blocks, usize count);
+void sha256_compress(Sha256Kernel kernel, u32 state[8], const u8* blocks, usize count);
+
+// ==============================
+// Algorithm selection
+// ==============================
+
+enum class HashAlgo : u8 {
+    MD5,
+    SHA256,
+};
+
+static constexpr usize MAX_DIGEST_SIZE = Sha256::DIGEST_SIZE;
+
+struct HashDigest {
+    u8 bytes[MAX_DIGEST_SIZE];
+    usize size;
+};
+
+const char* hash_algo_name(HashAlgo algo);
+bool hash_algo_from_name(const char* name, HashAlgo* algo);
+usize hash_digest_size(HashAlgo algo);
+
+// Streaming context for an algorithm picked at runtime
+class Hasher {
+private:
+    HashAlgo algo;
+    Md5 md5;
+    Sha256 sha256;
+public:
+    Hasher(HashAlgo algo) : algo(algo) { }
+
+    HashAlgo algorithm() const {
+        return algo;
+    }
+
+    void update(Span<const u8> data);
+    HashDigest finalize();
+public:
+    static HashDigest hash(HashAlgo algo, Span<const u8> data) {
+        Hasher h = Hasher(algo);
+        h.update(data);
+        return h.finalize();
+    }
+};
+
+// ==============================
+// Utilities
+// ==============================
+
+// Lowercase hex string, two characters per byte
+static inline std::string to_hex(const u8* bytes, usize len) {
+    static const char DIGITS[] = "0123456789abcdef";
+    std::string result = std::string(len * 2, '\0');
+    for (usize i = 0; i < len; ++i) {
+        result[i * 2 + 0] = DIGITS[bytes[i] >> 4];
+        result[i * 2 + 1] = DIGITS[bytes[i] & 0xF];
+    }
+    return result;
+}
+
+static inline std::string to_hex(const HashDigest& digest) {
+    return to_hex(digest.bytes, digest.size);
+}
+
+}
+
+#endif // _FUN_HASH_HH_
@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: MIT
+
+#include "hashcache.hh"
+
+#include <algorithm> // std::stable_sort, std::lower_bound
+
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace hk {
+
+#ifndef _WIN32
+
+static const char HASH_CACHE_MAGIC[4] = { 'H', 'K', 'H', 'C' };
+
+static bool entry_less(const HashCache::Entry& left, const HashCache::Entry& right) {
+    if (left.device != right.device) {
+        return left.device < right.device;
+    }
+    if (left.inode != right.inode) {
+        return left.inode < right.inode;
+    }
+    return left.algo < right.algo;
+}
+
+static bool entry_same_key(const HashCache::Entry& left, const HashCache::Entry& right) {
+    return !entry_less(left, right) && !entry_less(right, left);
+}
+
+bool file_stamp(const char* path, FileStamp* stamp) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    stamp->device = (u64)st.st_dev;
+    stamp->inode = (u64)st.st_ino;
+    stamp->size = (u64)st.st_size;
+#ifdef __APPLE__
+    stamp->mtime_ns = (i64)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp->mtime_ns = (i64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+HashCache::~HashCache() {
+    close();
+}
+
+void HashCache::close() {
+    if (map != nullptr) {
+        munmap((void*)map, map_size);
+    }
+    map = nullptr;
+    map_size = 0;
+    entries = nullptr;
+    count = 0;
+    stale.reset();
+}
+
+bool HashCache::open(const char* path) {
+    close();
+    this->path.clear();
+
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        this->path = path;
+        return true;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if ((usize)st.st_size < sizeof(Header)) {
+        ::close(fd);
+        if (st.st_size != 0) {
+            return false;
+        }
+        this->path = path;
+        return true;
+    }
+
+    void* p = mmap(nullptr, (usize)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    map = (const u8*)p;
+    map_size = (usize)st.st_size;
+
+    Header header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, HASH_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION ||
+        map_size != sizeof(Header) + header.count * sizeof(Entry)) {
+        close();
+        return false;
+    }
+
+    entries = (const Entry*)(map + sizeof(Header));
+    count = header.count;
+    stale = std::unique_ptr<std::atomic<u8>[]>(new std::atomic<u8>[count]());
+    this->path = path;
+    return true;
+}
+
+bool HashCache::lookup(const FileStamp& stamp, HashAlgo algo, HashDigest* digest) {
+    Entry key = Entry();
+    key.device = stamp.device;
+    key.inode = stamp.inode;
+    key.algo = (u8)algo;
+
+    const Entry* it = std::lower_bound(entries, entries + count, key, entry_less);
+    if (it == entries + count || !entry_same_key(*it, key)) {
+        return false;
+    }
+    if (it->size != stamp.size || it->mtime_ns != stamp.mtime_ns || it->digest_size != hash_digest_size(algo)) {
+        stale[it - entries].store(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    digest->size = it->digest_size;
+    memcpy(digest->bytes, it->digest, it->digest_size);
+    return true;
+}
+
+void HashCache::insert(const FileStamp& stamp, HashAlgo algo, const HashDigest& digest) {
+    Entry e = Entry();
+    e.device = stamp.device;
+    e.inode = stamp.inode;
+    e.size = stamp.size;
+    e.mtime_ns = stamp.mtime_ns;
+    e.algo = (u8)algo;
+    e.digest_size = (u8)digest.size;
+    memcpy(e.digest, digest.bytes, digest.size);
+
+    std::lock_guard<std::mutex> lk(lock);
+    pending.push_back(e);
+}
+
+bool HashCache::save() {
+    std::lock_guard<std::mutex> lk(lock);
+    if (path.empty()) {
+        return false;
+    }
+
+    // Newest entry wins among duplicates, then merge with the mapped entries, replacing or dropping stale ones
+    std::stable_sort(pending.begin(), pending.end(), entry_less);
+    std::vector<Entry> fresh = std::vector<Entry>();
+    for (usize i = 0; i < pending.size(); ++i) {
+        if (i + 1 < pending.size() && entry_same_key(pending[i], pending[i + 1])) {
+            continue;
+        }
+        fresh.push_back(pending[i]);
+    }
+
+    std::vector<Entry> merged = std::vector<Entry>();
+    merged.reserve(count + fresh.size());
+    usize i = 0;
+    usize j = 0;
+    while (i < count || j < fresh.size()) {
+        if (j == fresh.size() || (i < count && entry_less(entries[i], fresh[j]))) {
+            if (!stale[i].load(std::memory_order_relaxed)) {
+                merged.push_back(entries[i]);
+            }
+            i += 1;
+        } else {
+            if (i < count && entry_same_key(entries[i], fresh[j])) {
+                i += 1;
+            }
+            merged.push_back(fresh[j++]);
+        }
+    }
+
+    Header header = Header();
+    memcpy(header.magic, HASH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.count = merged.size();
+
+    // Write next to the old file and rename over it, so a crash never leaves a torn cache behind
+    const std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+    if (!merged.empty()) {
+        ok = ok && std::fwrite(merged.data(), sizeof(Entry), merged.size(), f) == merged.size();
+    }
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+
+    pending.clear();
+    const std::string saved = path;
+    return open(saved.c_str());
+}
+
+#else
+
+// No inodes or mmap here, the cache is always empty
+
+bool file_stamp(const char* path, FileStamp* stamp) {
+    return false;
+}
+
+HashCache::~HashCache() {
+}
+
+void HashCache::close() {
+}
+
+bool HashCache::open(const char* path) {
+    this->path = path;
+    return true;
+}
+
+bool HashCache::lookup(const FileStamp& stamp, HashAlgo algo, HashDigest* digest) {
+    return false;
+}
+
+void HashCache::insert(const FileStamp& stamp, HashAlgo algo, const HashDigest& digest) {
+}
+
+bool HashCache::save() {
+    return true;
+}
+
+#endif // _WIN32
+
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef _FUN_HASHCACHE_HH_
+#define _FUN_HASHCACHE_HH_
+
+#include "hk.hh"
+#include "hash.hh"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace hk {
+
+// Identity and version of a file on disk. A file whose stamp hasn't changed is assumed to still have the same
+// contents.
+struct FileStamp {
+    u64 device;
+    u64 inode;
+    u64 size;
+    i64 mtime_ns;
+};
+
+// False if the file can't be stat'ed, or on platforms without inodes
+bool file_stamp(const char* path, FileStamp* stamp);
+
+// Persistent content-hash cache. On disk it's a header followed by fixed-size entries sorted by (device, inode,
+// algorithm), so an existing cache is mmap'ed and binary searched in place without being parsed or copied.
+// Entries also record size and mtime, and only count as a hit when both still match. The layout is native-endian,
+// caches aren't meant to move between machines.
+//
+// lookup() and insert() may be called from any thread. New entries are kept in memory until save(), which merges
+// them with the mapped table and atomically replaces the file. Entries this run never looked at are kept, so hashing
+// a subset of files or another algorithm doesn't forget the rest. An entry whose file lookup() found changed is
+// dropped, or replaced by its insert(). The cache doesn't know paths, so a deleted file's entry lingers until its
+// inode is reused.
+class HashCache {
+public:
+    struct Entry {
+        u64 device;
+        u64 inode;
+        u64 size;
+        i64 mtime_ns;
+        u8 algo;
+        u8 digest_size;
+        u8 reserved[6];
+        u8 digest[MAX_DIGEST_SIZE];
+    };
+
+    struct Header {
+        char magic[4];
+        u32 version;
+        u64 count;
+    };
+
+    static constexpr u32 VERSION = 1;
+private:
+    std::string path;
+    const u8* map;
+    usize map_size;
+    const Entry* entries;
+    usize count;
+    // Per mapped entry, whether lookup() found its file changed since it was cached
+    std::unique_ptr<std::atomic<u8>[]> stale;
+
+    std::mutex lock;
+    std::vector<Entry> pending;
+public:
+    HashCache() : map(nullptr), map_size(0), entries(nullptr), count(0) { }
+    ~HashCache();
+
+    HashCache(const HashCache&) = delete;
+    HashCache& operator=(const HashCache&) = delete;
+
+    // A missing file is fine and starts an empty cache. Returns false, and leaves nothing for save() to write, if the
+    // file exists but isn't a valid cache.
+    bool open(const char* path);
+    bool save();
+
+    bool lookup(const FileStamp& stamp, HashAlgo algo, HashDigest* digest);
+    void insert(const FileStamp& stamp, HashAlgo algo, const HashDigest& digest);
+
+    usize size() const {
+        return count;
+    }
+private:
+    void close();
+};
+
+}
+
+#endif // _FUN_HASHCACHE_HH_
@@ -0,0 +1,574 @@
+// SPDX-License-Identifier: MIT
+
+#include "hashio.hh"
+
+#include <filesystem>
+#include <memory>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#   define HASHIO_URING 1
+#   include <fcntl.h>
+#   include <linux/io_uring.h>
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
+
+namespace hk {
+
+namespace fs = std::filesystem;
+
+// ==============================
+// File hashing
+// ==============================
+
+bool hash_file(const char* path, HashAlgo algo, HashDigest* digest) {
+    std::FILE* f = std::fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    std::vector<u8> buf = std::vector<u8>(READ_CHUNK_SIZE);
+    Hasher hasher = Hasher(algo);
+    usize n = 0;
+    while ((n = std::fread(buf.data(), 1, buf.size(), f)) > 0) {
+        hasher.update(Span<const u8>(buf.data(), n));
+    }
+    const bool ok = !std::ferror(f);
+    std::fclose(f);
+
+    *digest = hasher.finalize();
+    return ok;
+}
+
+bool read_file(const char* path, std::vector<u8>* data) {
+    std::FILE* f = std::fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    data->clear();
+    u8 buf[16 * 1024];
+    usize n = 0;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) {
+        data->insert(data->end(), buf, buf + n);
+    }
+    const bool ok = !std::ferror(f);
+    std::fclose(f);
+    return ok;
+}
+
+// ==============================
+// io_uring reader
+// ==============================
+
+#ifdef HASHIO_URING
+
+namespace {
+
+enum class UringOp : u8 {
+    OPEN,
+    READ,
+    CLOSE,
+};
+
+// What one of the QUEUE_DEPTH slots is doing. Each slot has at most one request in flight.
+struct UringSlot {
+    usize file;
+    int fd;
+    u64 offset;
+    UringOp op;
+};
+
+}
+
+struct UringRing {
+    int fd;
+    bool fixed_buffers;
+
+    void* sq_map;
+    usize sq_map_size;
+    void* cq_map;
+    usize cq_map_size;
+    io_uring_sqe* sqes;
+    usize sqes_size;
+
+    u32* sq_tail;
+    u32 sq_mask;
+    u32* sq_array;
+    // Entries queued since the last io_uring_enter(), ours until it publishes local_tail
+    u32 local_tail;
+    u32 to_submit;
+
+    u32* cq_head;
+    u32* cq_tail;
+    u32 cq_mask;
+    io_uring_cqe* cqes;
+
+    u8* buffers;
+    UringSlot slots[UringReader::QUEUE_DEPTH];
+};
+
+static int uring_setup(u32 entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, u32 to_submit, u32 min_complete, u32 flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int uring_register(int fd, u32 opcode, void* arg, u32 nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_destroy(UringRing* ring) {
+    if (ring->buffers != nullptr) {
+        munmap(ring->buffers, (usize)UringReader::QUEUE_DEPTH * UringReader::BUFFER_SIZE);
+    }
+    if (ring->sqes != nullptr) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != nullptr && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != nullptr) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    delete ring;
+}
+
+static bool uring_supports(int fd) {
+    const usize size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+    std::vector<u8> buf = std::vector<u8>(size);
+    io_uring_probe* probe = (io_uring_probe*)buf.data();
+    if (uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+        return false;
+    }
+    for (u8 op : { (u8)IORING_OP_OPENAT, (u8)IORING_OP_READ, (u8)IORING_OP_READ_FIXED, (u8)IORING_OP_CLOSE }) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static io_uring_sqe* uring_next_sqe(UringRing* ring, u64 user_data) {
+    const u32 index = ring->local_tail & ring->sq_mask;
+    io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    ring->local_tail += 1;
+    ring->to_submit += 1;
+    return sqe;
+}
+
+static void uring_queue(UringRing* ring, usize slot_index, const char* path) {
+    UringSlot& slot = ring->slots[slot_index];
+    io_uring_sqe* sqe = uring_next_sqe(ring, slot_index);
+    switch (slot.op) {
+    case UringOp::OPEN: {
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (u64)(uintptr_t)path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    } break;
+    case UringOp::READ: {
+        sqe->opcode = ring->fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = slot.fd;
+        sqe->addr = (u64)(uintptr_t)&ring->buffers[slot_index * UringReader::BUFFER_SIZE];
+        sqe->len = (u32)UringReader::BUFFER_SIZE;
+        sqe->off = slot.offset;
+        sqe->buf_index = (u16)slot_index;
+    } break;
+    case UringOp::CLOSE: {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = slot.fd;
+    } break;
+    }
+}
+
+UringReader::~UringReader() {
+    if (ring != nullptr) {
+        uring_destroy(ring);
+    }
+}
+
+bool UringReader::init() {
+    if (ring != nullptr) {
+        return true;
+    }
+
+    UringRing* r = new UringRing();
+    r->fd = -1;
+
+    io_uring_params params = io_uring_params();
+    r->fd = uring_setup(QUEUE_DEPTH, &params);
+    if (r->fd < 0 || !uring_supports(r->fd)) {
+        uring_destroy(r);
+        return false;
+    }
+
+    r->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    r->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        r->sq_map_size = r->cq_map_size = max(r->sq_map_size, r->cq_map_size);
+    }
+    r->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    void* p = mmap(nullptr, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->sq_map = (p == MAP_FAILED) ? nullptr : p;
+    if (single_mmap) {
+        r->cq_map = r->sq_map;
+    } else if (r->sq_map != nullptr) {
+        p = mmap(nullptr, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        r->cq_map = (p == MAP_FAILED) ? nullptr : p;
+    }
+    p = mmap(nullptr, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    r->sqes = (p == MAP_FAILED) ? nullptr : (io_uring_sqe*)p;
+    p = mmap(nullptr, (usize)QUEUE_DEPTH * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->buffers = (p == MAP_FAILED) ? nullptr : (u8*)p;
+    if (r->sq_map == nullptr || r->cq_map == nullptr || r->sqes == nullptr || r->buffers == nullptr) {
+        uring_destroy(r);
+        return false;
+    }
+
+    u8* sq = (u8*)r->sq_map;
+    r->sq_tail = (u32*)(sq + params.sq_off.tail);
+    r->local_tail = *r->sq_tail;
+    r->sq_mask = *(u32*)(sq + params.sq_off.ring_mask);
+    r->sq_array = (u32*)(sq + params.sq_off.array);
+    u8* cq = (u8*)r->cq_map;
+    r->cq_head = (u32*)(cq + params.cq_off.head);
+    r->cq_tail = (u32*)(cq + params.cq_off.tail);
+    r->cq_mask = *(u32*)(cq + params.cq_off.ring_mask);
+    r->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Pinned memory counts against RLIMIT_MEMLOCK on older kernels, plain reads into the same buffers still work
+    iovec iov[QUEUE_DEPTH];
+    for (u32 i = 0; i < QUEUE_DEPTH; ++i) {
+        iov[i].iov_base = &r->buffers[i * BUFFER_SIZE];
+        iov[i].iov_len = BUFFER_SIZE;
+    }
+    r->fixed_buffers = uring_register(r->fd, IORING_REGISTER_BUFFERS, iov, QUEUE_DEPTH) == 0;
+
+    ring = r;
+    return true;
+}
+
+void UringReader::read_files(Span<const std::string> paths, std::vector<u8>* data, bool* ok) {
+    if (ring == nullptr && !init()) {
+        for (usize i = 0; i < paths.size(); ++i) {
+            ok[i] = read_file(paths[i].c_str(), &data[i]);
+        }
+        return;
+    }
+
+    for (UringSlot& slot : ring->slots) {
+        slot.fd = -1;
+        slot.op = UringOp::OPEN;
+    }
+    std::vector<bool> finished = std::vector<bool>(paths.size(), false);
+    usize next = 0;
+    usize busy = 0;
+
+    auto start = [&](usize slot_index) {
+        if (next == paths.size()) {
+            return;
+        }
+        UringSlot& slot = ring->slots[slot_index];
+        slot.file = next++;
+        slot.fd = -1;
+        slot.offset = 0;
+        slot.op = UringOp::OPEN;
+        data[slot.file].clear();
+        ok[slot.file] = false;
+        uring_queue(ring, slot_index, paths[slot.file].c_str());
+        busy += 1;
+    };
+
+    for (usize i = 0; i < QUEUE_DEPTH; ++i) {
+        start(i);
+    }
+
+    bool failed = false;
+    while (busy > 0) {
+        // Publishing the tail hands the queued entries to the kernel
+        __atomic_store_n(ring->sq_tail, ring->local_tail, __ATOMIC_RELEASE);
+        const int submitted = uring_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = true;
+            break;
+        }
+        ring->to_submit -= (u32)submitted;
+
+        u32 head = *ring->cq_head;
+        const u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = ring->cqes[head & ring->cq_mask];
+            const usize slot_index = (usize)cqe.user_data;
+            UringSlot& slot = ring->slots[slot_index];
+            switch (slot.op) {
+            case UringOp::OPEN: {
+                if (cqe.res < 0) {
+                    finished[slot.file] = true;
+                    busy -= 1;
+                    start(slot_index);
+                    continue;
+                }
+                slot.fd = cqe.res;
+                slot.op = UringOp::READ;
+            } break;
+            case UringOp::READ: {
+                if (cqe.res > 0) {
+                    const u8* buf = &ring->buffers[slot_index * BUFFER_SIZE];
+                    data[slot.file].insert(data[slot.file].end(), buf, buf + cqe.res);
+                    slot.offset += (u64)cqe.res;
+                } else {
+                    // Zero at EOF, a read error otherwise
+                    ok[slot.file] = cqe.res == 0;
+                    slot.op = UringOp::CLOSE;
+                }
+            } break;
+            case UringOp::CLOSE: {
+                finished[slot.file] = true;
+                busy -= 1;
+                start(slot_index);
+                continue;
+            } break;
+            }
+            uring_queue(ring, slot_index, nullptr);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (failed) {
+        // The ring is in an unknown state, drop it (which cancels whatever is in flight) and finish with plain reads
+        for (const UringSlot& slot : ring->slots) {
+            if (slot.fd >= 0 && !finished[slot.file]) {
+                close(slot.fd);
+            }
+        }
+        uring_destroy(ring);
+        ring = nullptr;
+        for (usize i = 0; i < paths.size(); ++i) {
+            if (!finished[i]) {
+                ok[i] = read_file(paths[i].c_str(), &data[i]);
+            }
+        }
+    }
+}
+
+UringReader* thread_uring_reader() {
+    static thread_local UringReader reader;
+    static thread_local bool available = reader.init();
+    return available ? &reader : nullptr;
+}
+
+#else
+
+UringReader::~UringReader() {
+}
+
+bool UringReader::init() {
+    return false;
+}
+
+void UringReader::read_files(Span<const std::string> paths, std::vector<u8>* data, bool* ok) {
+    for (usize i = 0; i < paths.size(); ++i) {
+        ok[i] = read_file(paths[i].c_str(), &data[i]);
+    }
+}
+
+UringReader* thread_uring_reader() {
+    return nullptr;
+}
+
+#endif // HASHIO_URING
+
+// ==============================
+// Tree hashing
+// ==============================
+
+// Enough leaves per job to keep per-job overhead (a fopen and a seek) negligible, few enough that a file of a
+// few hundred MiB still spreads over every worker
+static constexpr usize TREE_JOB_SIZE = 16 * 1024 * 1024;
+
+static constexpr u8 TREE_LEAF_PREFIX = 0x00;
+static constexpr u8 TREE_NODE_PREFIX = 0x01;
+
+std::string tree_hash_label(HashAlgo algo, usize leaf_size) {
+    char label[64];
+    snprintf(label, sizeof(label), "%s-tree-%uk", hash_algo_name(algo), (u32)(leaf_size / 1024));
+    return label;
+}
+
+HashDigest tree_hash_leaf(HashAlgo algo, Span<const u8> data) {
+    Hasher hasher = Hasher(algo);
+    hasher.update(Span<const u8>(&TREE_LEAF_PREFIX, 1));
+    hasher.update(data);
+    return hasher.finalize();
+}
+
+HashDigest tree_hash_root(HashAlgo algo, Span<const HashDigest> leaves) {
+    if (leaves.empty()) {
+        return tree_hash_leaf(algo, Span<const u8>());
+    }
+
+    std::vector<HashDigest> level = std::vector<HashDigest>(leaves.begin(), leaves.end());
+    while (level.size() > 1) {
+        usize n = 0;
+        for (usize i = 0; i + 1 < level.size(); i += 2) {
+            Hasher hasher = Hasher(algo);
+            hasher.update(Span<const u8>(&TREE_NODE_PREFIX, 1));
+            hasher.update(Span<const u8>(level[i].bytes, level[i].size));
+            hasher.update(Span<const u8>(level[i + 1].bytes, level[i + 1].size));
+            level[n++] = hasher.finalize();
+        }
+        if (level.size() % 2 != 0) {
+            level[n++] = level.back();
+        }
+        level.resize(n);
+    }
+    return level[0];
+}
+
+namespace {
+
+struct TreeHashState {
+    std::string path;
+    HashAlgo algo;
+    usize leaf_size;
+    u64 file_size;
+    std::vector<HashDigest> leaves;
+    std::atomic<usize> pending;
+    std::atomic<bool> ok;
+    TreeHashFn done;
+};
+
+}
+
+static bool seek_file(std::FILE* f, u64 offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Leaves [first, last) of the file
+static bool tree_hash_leaves(TreeHashState* state, usize first, usize last) {
+    std::FILE* f = std::fopen(state->path.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    bool ok = seek_file(f, (u64)first * state->leaf_size);
+    std::vector<u8> buf = std::vector<u8>(min(state->leaf_size, READ_CHUNK_SIZE));
+    for (usize leaf = first; ok && leaf < last; ++leaf) {
+        const u64 offset = (u64)leaf * state->leaf_size;
+        const u64 size = min<u64>(state->leaf_size, state->file_size - offset);
+
+        Hasher hasher = Hasher(state->algo);
+        hasher.update(Span<const u8>(&TREE_LEAF_PREFIX, 1));
+        u64 done = 0;
+        while (done < size) {
+            const usize n = std::fread(buf.data(), 1, (usize)min<u64>(buf.size(), size - done), f);
+            if (n == 0) {
+                // Shrunk while we were reading
+                ok = false;
+                break;
+            }
+            hasher.update(Span<const u8>(buf.data(), n));
+            done += n;
+        }
+        state->leaves[leaf] = hasher.finalize();
+    }
+    ok = ok && !std::ferror(f);
+    std::fclose(f);
+    return ok;
+}
+
+void tree_hash_file(ThreadPool* pool, const std::string& path, HashAlgo algo, usize leaf_size, TreeHashFn done) {
+    HK_ASSERT(leaf_size > 0 && leaf_size % 1024 == 0);
+    pool->submit([pool, path, algo, leaf_size, done]() {
+        std::error_code ec;
+        const u64 size = fs::file_size(path, ec);
+        if (ec) {
+            done(false, HashDigest());
+            return;
+        }
+
+        std::shared_ptr<TreeHashState> state = std::make_shared<TreeHashState>();
+        state->path = path;
+        state->algo = algo;
+        state->leaf_size = leaf_size;
+        state->file_size = size;
+        state->leaves.resize(max<usize>(1, (usize)((size + leaf_size - 1) / leaf_size)));
+        state->ok = true;
+        state->done = done;
+
+        if (size == 0) {
+            state->leaves[0] = tree_hash_leaf(algo, Span<const u8>());
+            done(true, tree_hash_root(algo, state->leaves));
+            return;
+        }
+
+        const usize leaves_per_job = max<usize>(1, TREE_JOB_SIZE / leaf_size);
+        const usize jobs = (state->leaves.size() + leaves_per_job - 1) / leaves_per_job;
+        state->pending = jobs;
+        for (usize j = 0; j < jobs; ++j) {
+            const usize first = j * leaves_per_job;
+            const usize last = min(state->leaves.size(), first + leaves_per_job);
+            pool->submit([state, first, last]() {
+                if (!tree_hash_leaves(state.get(), first, last)) {
+                    state->ok = false;
+                }
+                if (--state->pending == 0) {
+                    state->done(state->ok, tree_hash_root(state->algo, state->leaves));
+                }
+            });
+        }
+    });
+}
+
+// ==============================
+// Directory walking
+// ==============================
+
+void walk_tree(ThreadPool* pool, const std::string& root, const FilesFn* on_files, const WalkErrorFn* on_error) {
+    pool->submit([pool, root, on_files, on_error]() {
+        std::vector<FileEntry> files = std::vector<FileEntry>();
+        std::error_code ec;
+        for (auto it = fs::directory_iterator(root, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            const fs::directory_entry& entry = *it;
+            std::error_code entry_ec;
+            if (entry.is_symlink(entry_ec) && entry.is_directory(entry_ec)) {
+                // Don't follow directory links, they can form cycles
+                continue;
+            }
+            if (entry.is_directory(entry_ec)) {
+                walk_tree(pool, entry.path().string(), on_files, on_error);
+            } else if (entry.is_regular_file(entry_ec)) {
+                const u64 size = entry.file_size(entry_ec);
+                files.push_back({ entry.path().string(), entry_ec ? 0 : size });
+            }
+        }
+        if (!files.empty()) {
+            (*on_files)(std::move(files));
+        }
+        if (ec) {
+            (*on_error)(root);
+        }
+    });
+}
+
+}
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef _FUN_HASHIO_HH_
+#define _FUN_HASHIO_HH_
+
+#include "hk.hh"
+#include "hash.hh"
+#include "threads.hh"
+
+#include <functional>
+
+namespace hk {
+
+// ==============================
+// File hashing
+// ==============================
+
+// Files are streamed through the hasher in fixed-size chunks, so memory use doesn't depend on file size and the
+// OS readahead can fetch the next chunk while the current one is being hashed.
+constexpr usize READ_CHUNK_SIZE = 256 * 1024;
+
+bool hash_file(const char* path, HashAlgo algo, HashDigest* digest);
+
+// Whole file into data. For small files, where streaming buys nothing.
+bool read_file(const char* path, std::vector<u8>* data);
+
+// ==============================
+// io_uring reader
+// ==============================
+
+// Reads batches of whole files through Linux io_uring. Up to QUEUE_DEPTH files are in flight at once, each one's
+// open, reads and close queued as the previous step completes, and every round of them goes to the kernel in a
+// single io_uring_enter(), so a batch of small files costs a handful of syscalls instead of four per file. Reads
+// land in per-slot buffers registered with the ring once up front (plain reads if registering isn't allowed).
+//
+// Raw syscalls, no liburing. Not thread-safe, use thread_uring_reader() for one per thread.
+struct UringRing;
+
+class UringReader {
+public:
+    static constexpr u32 QUEUE_DEPTH = 64;
+    static constexpr usize BUFFER_SIZE = 64 * 1024;
+private:
+    UringRing* ring;
+public:
+    UringReader() : ring(nullptr) { }
+    ~UringReader();
+
+    UringReader(const UringReader&) = delete;
+    UringReader& operator=(const UringReader&) = delete;
+
+    // False if io_uring is unavailable: not Linux, kernel too old for the opcodes used, or blocked (seccomp,
+    // io_uring_disabled sysctl)
+    bool init();
+
+    // Same as read_file() on every path, ok[i] tells whether data[i] is complete
+    void read_files(Span<const std::string> paths, std::vector<u8>* data, bool* ok);
+};
+
+// The calling thread's reader, created on first use. nullptr if io_uring is unavailable.
+UringReader* thread_uring_reader();
+
+// ==============================
+// Tree hashing
+// ==============================
+
+// Merkle tree over fixed-size leaves, so one big file can be hashed on every core. Leaves are H(0x00 || leaf) and
+// interior nodes H(0x01 || left || right); an odd node at the end of a level moves up unchanged, and a file of at
+// most one leaf has that leaf's hash as its root. The prefixes keep leaf and node hashes apart, and make the root
+// differ from the plain digest of the file even when it's a single leaf, which is why it's always shown with
+// tree_hash_label().
+constexpr usize TREE_LEAF_SIZE = 1024 * 1024;
+
+using TreeHashFn = std::function<void(bool ok, const HashDigest& root)>;
+
+// e.g. "md5-tree-1024k", leaf_size must be a multiple of 1 KiB
+std::string tree_hash_label(HashAlgo algo, usize leaf_size);
+
+HashDigest tree_hash_leaf(HashAlgo algo, Span<const u8> data);
+HashDigest tree_hash_root(HashAlgo algo, Span<const HashDigest> leaves);
+
+// Hashes the file's leaves as jobs on the pool and calls done from the worker that finishes the last one.
+// Never blocks, so it can be called from inside a job too.
+void tree_hash_file(ThreadPool* pool, const std::string& path, HashAlgo algo, usize leaf_size, TreeHashFn done);
+
+// ==============================
+// Directory walking
+// ==============================
+
+struct FileEntry {
+    std::string path;
+    u64 size;
+};
+
+using FilesFn = std::function<void(std::vector<FileEntry> files)>;
+using WalkErrorFn = std::function<void(const std::string& path)>;
+
+// Walks a directory tree on the pool. Every directory listing is a job of its own, and queues its subdirectories
+// as further jobs, so the walk is parallel too. on_files gets each directory's regular files in one call, on
+// whichever worker listed it. Directory symlinks aren't followed. Both callbacks must outlive the walk (until
+// pool->wait() returns).
+void walk_tree(ThreadPool* pool, const std::string& root, const FilesFn* on_files, const WalkErrorFn* on_error);
+
+}
+
+#endif // _FUN_HASHIO_HH_
@@ -73,11 +73,54 @@ static inline constexpr T max(T x1, T x2) {
     return (x1 > x2) ? x1 : x2;
 }
 
+template <typename T>
+static inline constexpr T clamp(T val, T lower, T upper) {
+    return min(max(val, lower), upper);
+}
+
 template <typename T>
 static inline constexpr bool inrange(T val, T lower, T upper) {
     return val >= lower && val <= upper;
 }
 
+// ==============================
+// Containers
+// ==============================
+
+// Non-owning view over contiguous memory (std::span is C++20)
+template <typename T>
+class Span {
+private:
+    T* ptr;
+    usize count;
+public:
+    Span() : ptr(nullptr), count(0) { }
+
+    Span(T* ptr, usize count) : ptr(ptr), count(count) { }
+
+    template <typename U>
+    Span(std::vector<U>& v) : ptr(v.data()), count(v.size()) { }
+
+    template <typename U>
+    Span(const std::vector<U>& v) : ptr(v.data()), count(v.size()) { }
+
+    T* data() const { return ptr; }
+    usize size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    T* begin() const { return ptr; }
+    T* end() const { return ptr + count; }
+
+    T& operator[](usize idx) const {
+        return ptr[idx];
+    }
+
+    Span subspan(usize offset, usize n = (usize)-1) const {
+        HK_ASSERT(offset <= count);
+        return Span(ptr + offset, min(n, count - offset));
+    }
+};
+
 // ==============================
 // Debugging
 // ==============================
@@ -1,139 +1,717 @@
 // SPDX-License-Identifier: MIT
 
-// https://en.wikipedia.org/wiki/MD5
-// https://github.com/B-Con/crypto-algorithms/blob/master/md5.c
-
 #include "hk.hh"
+#include "hash.hh"
+#include "hashcache.hh"
+#include "hashio.hh"
+#include "threads.hh"
+
+#include <algorithm> // std::sort
+#include <atomic>
+#include <condition_variable>
 
 using namespace hk;
 
-static const u32 MD5_SHIFT_TABLE[64] = {
-    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
-    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
-    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
-    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
-};
+// Files up to this size are read whole and hashed in batches (through md5_multi() for MD5)
+static constexpr usize SMALL_FILE_SIZE = 64 * 1024;
+static constexpr usize SMALL_FILE_BATCH = 64;
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: md5 [options] <file...>\n"
+        "       md5 [options] -r <dir...>\n"
+        "       md5 [options] --dedupe <dir...>\n"
+        "       md5 [options] --tree [--verify <digest>] <file...>\n"
+        "       md5 [options] -c <manifest>\n"
+        "\n"
+        "Options:\n"
+        "  -a <algorithm>  md5 (default) or sha256\n"
+        "  -r              Hash every file under the given directories\n"
+        "  -j <n>          Number of worker threads (default: one per hardware thread)\n"
+        "  --cache <file>  Reuse digests of files whose inode, size and mtime are unchanged since the last run\n"
+        "  --dedupe        Print sets of identical non-empty files under the given directories\n"
+        "  --tree          Hash files as a Merkle tree of leaves, hashed in parallel. Not the same digest as\n"
+        "                  without --tree, printed as <algorithm>-tree-<leaf size>:<hex>\n"
+        "  --leaf-size <n> Tree leaf size in KiB (default: 1024)\n"
+        "  --uring         Read small files in batches through io_uring (Linux), instead of a blocking read per file\n"
+        "  --verify <d>    Check every file against digest d instead of printing digests\n"
+        "  -c <manifest>   Check the files listed in an md5sum/sha256sum style manifest (- for stdin). The algorithm\n"
+        "                  of each line follows from its digest length or tree label. Results are printed as they\n"
+        "                  finish, not in manifest order.\n");
+}
+
+//
+// Parallel hashing
+//
 
-static const u32 MD5_SIN_TABLE[64] = {
-    0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE,
-    0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
-    0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE,
-    0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
-    0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA,
-    0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
-    0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED,
-    0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
-    0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C,
-    0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
-    0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05,
-    0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
-    0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039,
-    0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
-    0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1,
-    0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+struct HashResult {
+    std::string path;
+    usize order;
+    HashDigest digest;
+    bool ok;
+    // Taken before reading, so a file modified mid-hash just misses the cache next time
+    FileStamp stamp;
+    bool stamped;
 };
 
-int main(int argc, const char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: md5 <file>\n");
-        return EXIT_FAILURE;
+class HashJobs {
+private:
+    ThreadPool* pool;
+    HashAlgo algo;
+    HashCache* cache;
+    usize tree_leaf_size;
+    bool uring;
+    std::mutex lock;
+    std::vector<HashResult> results;
+    FilesFn on_files;
+    WalkErrorFn on_error;
+public:
+    // tree_leaf_size > 0 hashes with tree_hash_file() instead. Tree digests aren't cached. uring reads batches of
+    // small files through each worker's UringReader.
+    HashJobs(ThreadPool* pool, HashAlgo algo, HashCache* cache, usize tree_leaf_size, bool uring)
+        : pool(pool), algo(algo), cache(cache), tree_leaf_size(tree_leaf_size), uring(uring) {
+        on_files = [this](std::vector<FileEntry> files) {
+            std::vector<std::string> small = std::vector<std::string>();
+            for (FileEntry& f : files) {
+                if (f.size > SMALL_FILE_SIZE || this->tree_leaf_size > 0) {
+                    file(std::move(f.path), 0);
+                    continue;
+                }
+                small.push_back(std::move(f.path));
+                if (small.size() == SMALL_FILE_BATCH) {
+                    small_files(std::move(small));
+                    small.clear();
+                }
+            }
+            if (!small.empty()) {
+                small_files(std::move(small));
+            }
+        };
+        on_error = [this](const std::string& path) {
+            HashResult r = HashResult();
+            r.path = path;
+            r.ok = false;
+            add(&r, 1);
+        };
     }
 
-    std::vector<u8> file = load_binary_file(argv[1]);
-    if (!file.size()) {
-       fprintf(stderr, "Failed to load file %s\n", argv[1]);
-        return EXIT_FAILURE; 
-    }
-
-    // The MD5 algorithm expects data in 64-byte blocks. Data should be followed immediately by a "one" bit, then
-    // padded with zeroes until the last 8 bytes of the last block, where the size of the input in bytes is written.
-    // 
-    // https://www.desmos.com/calculator/hypjdhc7v7
-    const usize input_len = (((file.size() + 8) / 64) + 1) * 64;
-    std::vector<u8> input = std::vector<u8>(); input.resize(input_len);
-
-    // Set initial buffer
-    memcpy(&input[0], &file[0], file.size());
-
-    // Set "one" bit
-    input[file.size()] = 1 << 7;
-
-    // Write size in bite
-    const u64 size_bits = file.size() * 8;
-    memcpy(&input[input_len - sizeof(u64)], &size_bits, sizeof(size_bits));
-
-    // Set initial state
-    u32 state_A = 0x67452301;
-    u32 state_B = 0xEFCDAB89;
-    u32 state_C = 0x98BADCFE;
-    u32 state_D = 0x10325476;
-
-    // Process 512-bit chunks
-    HK_ASSERT(input_len % 64 == 0);
-    for (usize i = 0; i < input_len / 64; ++i) {
-        u32 a = state_A;
-        u32 b = state_B;
-        u32 c = state_C;
-        u32 d = state_D;
-
-        // https://en.wikipedia.org/wiki/MD5#Algorithm
-        #define F(b, c, d) ((b & c) | (~b & d))
-        #define G(b, c, d) ((b & d) | (c & ~d))
-        #define H(b, c, d) (b ^ c ^ d)
-        #define I(b, c, d) (c ^ (b | ~d))
-
-        for (u32 j = 0; j < 64; ++j) {
-            u32 f = 0;
-            u32 g = 0;
-            if (j < 16) {
-                f = F(b, c, d);
-                g = j;
+    // Single file, streamed
+    void file(std::string path, usize order) {
+        if (tree_leaf_size > 0) {
+            tree_hash_file(pool, path, algo, tree_leaf_size, [this, path, order](bool ok, const HashDigest& root) {
+                HashResult r = HashResult();
+                r.path = path;
+                r.order = order;
+                r.ok = ok;
+                r.digest = root;
+                add(&r, 1);
+            });
+            return;
+        }
+        pool->submit([this, path, order]() {
+            HashResult r = HashResult();
+            r.path = path;
+            r.order = order;
+            if (!cached(&r)) {
+                r.ok = hash_file(path.c_str(), algo, &r.digest);
+                remember(r);
             }
-            else if (j < 32) {
-                f = G(b, c, d);
-                g = (j * 5 + 1) % 16;
+            add(&r, 1);
+        });
+    }
+
+    // Batch of small files, read whole. MD5 hashes them one per SIMD lane.
+    void small_files(std::vector<std::string> paths) {
+        pool->submit([this, paths = std::move(paths)]() {
+            std::vector<HashResult> batch = std::vector<HashResult>(paths.size());
+            std::vector<usize> misses = std::vector<usize>();
+            for (usize i = 0; i < paths.size(); ++i) {
+                batch[i].path = paths[i];
+                if (!cached(&batch[i])) {
+                    misses.push_back(i);
+                }
             }
-            else if (j < 48) {
-                f = H(b, c, d);
-                g = (j * 3 + 5) % 16;
+
+            std::vector<std::vector<u8>> data = std::vector<std::vector<u8>>(misses.size());
+            UringReader* reader = uring ? thread_uring_reader() : nullptr;
+            if (reader != nullptr) {
+                std::vector<std::string> miss_paths = std::vector<std::string>();
+                for (usize i : misses) {
+                    miss_paths.push_back(paths[i]);
+                }
+                std::unique_ptr<bool[]> ok = std::unique_ptr<bool[]>(new bool[misses.size()]);
+                reader->read_files(miss_paths, data.data(), ok.get());
+                for (usize i = 0; i < misses.size(); ++i) {
+                    batch[misses[i]].ok = ok[i];
+                }
+            } else {
+                for (usize i = 0; i < misses.size(); ++i) {
+                    batch[misses[i]].ok = read_file(paths[misses[i]].c_str(), &data[i]);
+                }
             }
-            else {
-                f = I(b, c, d);
-                g = (j * 7) % 16;
+
+            if (algo == HashAlgo::MD5) {
+                std::vector<Span<const u8>> messages = std::vector<Span<const u8>>(data.begin(), data.end());
+                std::vector<Md5::Digest> digests = std::vector<Md5::Digest>(misses.size());
+                md5_multi(messages, digests.data());
+                for (usize i = 0; i < misses.size(); ++i) {
+                    HashDigest& digest = batch[misses[i]].digest;
+                    memcpy(digest.bytes, digests[i].bytes, sizeof(digests[i].bytes));
+                    digest.size = sizeof(digests[i].bytes);
+                }
+            } else {
+                for (usize i = 0; i < misses.size(); ++i) {
+                    batch[misses[i]].digest = Hasher::hash(algo, data[i]);
+                }
+            }
+
+            for (usize i : misses) {
+                remember(batch[i]);
+            }
+            add(batch.data(), batch.size());
+        });
+    }
+
+    // Every file under root. Each directory's small files are batched together.
+    void tree(const std::string& root) {
+        walk_tree(pool, root, &on_files, &on_error);
+    }
+
+    std::vector<HashResult>& finish() {
+        pool->wait();
+        return results;
+    }
+private:
+    // Fills in r from the cache if the file is unchanged since it was last hashed. On a miss, r->stamp is left for
+    // remember() to record once the file has been hashed.
+    bool cached(HashResult* r) {
+        if (cache == nullptr) {
+            return false;
+        }
+        r->stamped = file_stamp(r->path.c_str(), &r->stamp);
+        r->ok = r->stamped && cache->lookup(r->stamp, algo, &r->digest);
+        return r->ok;
+    }
+
+    void remember(const HashResult& r) {
+        if (cache != nullptr && r.ok && r.stamped) {
+            cache->insert(r.stamp, algo, r.digest);
+        }
+    }
+
+    void add(const HashResult* r, usize n) {
+        std::lock_guard<std::mutex> lk(lock);
+        results.insert(results.end(), r, r + n);
+    }
+};
+
+struct HashOptions {
+    HashAlgo algo;
+    bool recursive;
+    usize tree_leaf_size;
+    bool uring;
+    // Lowercase, with the tree label if any. Empty to print digests instead.
+    std::string verify;
+};
+
+static int run_hash(ThreadPool* pool, const HashOptions& options, const std::vector<const char*>& inputs, HashCache* cache) {
+    const bool recursive = options.recursive;
+    HashJobs jobs = HashJobs(pool, options.algo, cache, options.tree_leaf_size, options.uring);
+    for (usize i = 0; i < inputs.size(); ++i) {
+        if (recursive) {
+            jobs.tree(inputs[i]);
+        } else {
+            jobs.file(inputs[i], i);
+        }
+    }
+
+    // Workers finish in any order, sort so output is deterministic: argument order for files, path order for trees
+    std::vector<HashResult>& results = jobs.finish();
+    std::sort(results.begin(), results.end(), [recursive](const HashResult& left, const HashResult& right) {
+        return recursive ? left.path < right.path : left.order < right.order;
+    });
+
+    const std::string label = options.tree_leaf_size > 0 ? tree_hash_label(options.algo, options.tree_leaf_size) + ":" : "";
+    int status = EXIT_SUCCESS;
+    for (const HashResult& r : results) {
+        if (!r.ok) {
+            fprintf(stderr, "Failed to read %s\n", r.path.c_str());
+            status = EXIT_FAILURE;
+            continue;
+        }
+        const std::string digest = label + to_hex(r.digest);
+        if (!options.verify.empty()) {
+            const bool match = digest == options.verify;
+            printf("%s: %s\n", r.path.c_str(), match ? "OK" : "FAILED");
+            status = match ? status : EXIT_FAILURE;
+            continue;
+        }
+        // Same layout as md5sum/sha256sum
+        printf("%s  %s\n", digest.c_str(), r.path.c_str());
+    }
+    return status;
+}
+
+//
+// Duplicate finder
+//
+
+// Candidates are narrowed down in stages, each one only looking at files that still have a potential twin:
+//   1. size, which the directory walk gives for free
+//   2. hash of the first and last DEDUPE_EDGE_SIZE bytes
+//   3. full streaming hash
+// Files no bigger than both edges together are read whole in stage 2, so that hash is already the full one.
+static constexpr usize DEDUPE_EDGE_SIZE = 4096;
+static constexpr usize DEDUPE_BATCH = 32;
+
+struct DedupeFile {
+    std::string path;
+    u64 size;
+    HashDigest edges;
+    HashDigest full;
+    bool ok;
+};
+
+static bool hash_edges(const char* path, u64 size, HashAlgo algo, HashDigest* digest, u64* bytes_read) {
+    std::FILE* f = std::fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    u8 buf[DEDUPE_EDGE_SIZE * 2];
+    usize n = 0;
+    if (size <= sizeof(buf)) {
+        n = std::fread(buf, 1, sizeof(buf), f);
+    } else {
+        n = std::fread(buf, 1, DEDUPE_EDGE_SIZE, f);
+        if (std::fseek(f, -(long)DEDUPE_EDGE_SIZE, SEEK_END) == 0) {
+            n += std::fread(&buf[n], 1, DEDUPE_EDGE_SIZE, f);
+        }
+    }
+    const bool ok = !std::ferror(f);
+    std::fclose(f);
+
+    *digest = Hasher::hash(algo, Span<const u8>(buf, n));
+    *bytes_read = n;
+    return ok;
+}
+
+static std::string size_key(const DedupeFile& f) {
+    return std::string((const char*)&f.size, sizeof(f.size));
+}
+
+static std::string edges_key(const DedupeFile& f) {
+    return size_key(f) + std::string((const char*)f.edges.bytes, f.edges.size);
+}
+
+static std::string full_key(const DedupeFile& f) {
+    return size_key(f) + std::string((const char*)f.full.bytes, f.full.size);
+}
+
+// Groups of two or more readable candidates with equal keys, each group sorted by path
+template <typename Key>
+static std::vector<std::vector<usize>> dedupe_groups(const std::vector<DedupeFile>& files, const std::vector<usize>& candidates, Key key) {
+    std::vector<std::pair<std::string, usize>> keyed = std::vector<std::pair<std::string, usize>>();
+    for (usize i : candidates) {
+        if (files[i].ok) {
+            keyed.push_back({ key(files[i]), i });
+        }
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<std::vector<usize>> groups = std::vector<std::vector<usize>>();
+    for (usize i = 0; i < keyed.size(); ) {
+        usize j = i + 1;
+        while (j < keyed.size() && keyed[j].first == keyed[i].first) {
+            ++j;
+        }
+        if (j - i >= 2) {
+            std::vector<usize> group = std::vector<usize>();
+            for (usize k = i; k < j; ++k) {
+                group.push_back(keyed[k].second);
             }
-            f = f + a + MD5_SIN_TABLE[j] + ((u32*)&input[i * 64])[g];
-            a = d;
-            d = c;
-            c = b;
-            b = b + rotate_left(f, MD5_SHIFT_TABLE[j]);
+            std::sort(group.begin(), group.end(), [&files](usize left, usize right) {
+                return files[left].path < files[right].path;
+            });
+            groups.push_back(std::move(group));
         }
+        i = j;
+    }
+    return groups;
+}
 
-        #undef I
-        #undef H
-        #undef G
-        #undef F
+static std::vector<usize> flatten(const std::vector<std::vector<usize>>& groups) {
+    std::vector<usize> out = std::vector<usize>();
+    for (const std::vector<usize>& group : groups) {
+        out.insert(out.end(), group.begin(), group.end());
+    }
+    return out;
+}
 
-        state_A += a;
-        state_B += b;
-        state_C += c;
-        state_D += d;
+// Runs fn on every candidate, in batches on the pool
+template <typename F>
+static void dedupe_stage(ThreadPool* pool, std::vector<DedupeFile>* files, const std::vector<usize>& candidates, const F& fn) {
+    for (usize i = 0; i < candidates.size(); i += DEDUPE_BATCH) {
+        const usize end = min(candidates.size(), i + DEDUPE_BATCH);
+        pool->submit([files, &candidates, &fn, i, end]() {
+            for (usize k = i; k < end; ++k) {
+                fn(&(*files)[candidates[k]]);
+            }
+        });
     }
+    pool->wait();
+}
 
-    u8 digest[16];
+static int run_dedupe(ThreadPool* pool, HashAlgo algo, const std::vector<const char*>& inputs) {
+    int status = EXIT_SUCCESS;
 
-    const u32 result32[4] = {
-        state_A,
-        state_B,
-        state_C,
-        state_D,
+    std::mutex lock;
+    std::vector<DedupeFile> files = std::vector<DedupeFile>();
+    const FilesFn on_files = [&files, &lock](std::vector<FileEntry> entries) {
+        std::lock_guard<std::mutex> lk(lock);
+        for (FileEntry& e : entries) {
+            if (e.size > 0) {
+                files.push_back({ std::move(e.path), e.size, HashDigest(), HashDigest(), true });
+            }
+        }
     };
-    memcpy(digest, result32, sizeof(digest));
+    const WalkErrorFn on_error = [&status, &lock](const std::string& path) {
+        std::lock_guard<std::mutex> lk(lock);
+        fprintf(stderr, "Failed to read %s\n", path.c_str());
+        status = EXIT_FAILURE;
+    };
+    for (const char* input : inputs) {
+        walk_tree(pool, input, &on_files, &on_error);
+    }
+    pool->wait();
+
+    u64 total_bytes = 0;
+    std::vector<usize> candidates = std::vector<usize>(files.size());
+    for (usize i = 0; i < files.size(); ++i) {
+        total_bytes += files[i].size;
+        candidates[i] = i;
+    }
+
+    // Stage 1
+    candidates = flatten(dedupe_groups(files, candidates, size_key));
 
-    fprintf(stderr, "%s %x%x%x%x%x%x%x%x%x%x%x%x%x%x%x%x\n", argv[1],
-        digest[ 0], digest[ 1], digest[ 2], digest[ 3],
-        digest[ 4], digest[ 5], digest[ 6], digest[ 7],
-        digest[ 8], digest[ 9], digest[10], digest[11],
-        digest[12], digest[13], digest[14], digest[15]);
+    // Stage 2
+    std::atomic<u64> bytes_read = std::atomic<u64>(0);
+    dedupe_stage(pool, &files, candidates, [algo, &bytes_read](DedupeFile* f) {
+        u64 n = 0;
+        f->ok = hash_edges(f->path.c_str(), f->size, algo, &f->edges, &n);
+        if (f->size <= DEDUPE_EDGE_SIZE * 2) {
+            f->full = f->edges;
+        }
+        bytes_read += n;
+    });
+    candidates = flatten(dedupe_groups(files, candidates, edges_key));
+
+    // Stage 3
+    std::vector<usize> large = std::vector<usize>();
+    for (usize i : candidates) {
+        if (files[i].size > DEDUPE_EDGE_SIZE * 2) {
+            large.push_back(i);
+        }
+    }
+    dedupe_stage(pool, &files, large, [algo, &bytes_read](DedupeFile* f) {
+        f->ok = hash_file(f->path.c_str(), algo, &f->full);
+        bytes_read += f->size;
+    });
+
+    for (const DedupeFile& f : files) {
+        if (!f.ok) {
+            fprintf(stderr, "Failed to read %s\n", f.path.c_str());
+            status = EXIT_FAILURE;
+        }
+    }
+
+    // One md5sum-style block per set, sets separated by a blank line
+    std::vector<std::vector<usize>> sets = dedupe_groups(files, candidates, full_key);
+    std::sort(sets.begin(), sets.end(), [&files](const std::vector<usize>& left, const std::vector<usize>& right) {
+        return files[left[0]].path < files[right[0]].path;
+    });
+
+    u64 redundant_files = 0;
+    u64 redundant_bytes = 0;
+    for (usize s = 0; s < sets.size(); ++s) {
+        if (s > 0) {
+            printf("\n");
+        }
+        for (usize i : sets[s]) {
+            printf("%s  %s\n", to_hex(files[i].full).c_str(), files[i].path.c_str());
+        }
+        redundant_files += sets[s].size() - 1;
+        redundant_bytes += (sets[s].size() - 1) * files[sets[s][0]].size;
+    }
+
+    fprintf(stderr, "%llu files, %llu duplicate sets, %llu redundant files (%llu bytes)\n",
+        (unsigned long long)files.size(), (unsigned long long)sets.size(),
+        (unsigned long long)redundant_files, (unsigned long long)redundant_bytes);
+    fprintf(stderr, "Read %llu of %llu bytes (%.2f%%)\n",
+        (unsigned long long)bytes_read.load(), (unsigned long long)total_bytes,
+        total_bytes > 0 ? 100.0 * (f64)bytes_read.load() / (f64)total_bytes : 0.0);
+
+    return status;
+}
+
+//
+// Manifest checking
+//
+
+// Files being read at once. Bounds open files and memory when the manifest is huge, while keeping every worker
+// busy and some reads queued behind them.
+static constexpr usize CHECK_JOBS_PER_THREAD = 4;
+
+struct CheckEntry {
+    std::string path;
+    std::string expected;
+    HashAlgo algo;
+    usize tree_leaf_size;
+};
+
+// "<hex>  <path>", "<hex> *<path>" (binary marker) or "<algo>-tree-<n>k:<hex>  <path>"
+static bool parse_check_line(const std::string& line, CheckEntry* entry) {
+    const usize space = line.find(' ');
+    if (space == std::string::npos || space + 2 > line.size() || (line[space + 1] != ' ' && line[space + 1] != '*')) {
+        return false;
+    }
+    std::string digest = line.substr(0, space);
+    entry->path = line.substr(space + 2);
+    entry->tree_leaf_size = 0;
+
+    const usize colon = digest.find(':');
+    std::string hex = (colon == std::string::npos) ? digest : digest.substr(colon + 1);
+    for (char& c : hex) {
+        c = str::tolower(c);
+        if (!inrange(c, '0', '9') && !inrange(c, 'a', 'f')) {
+            return false;
+        }
+    }
+
+    if (colon != std::string::npos) {
+        const std::string label = digest.substr(0, colon);
+        const usize tree = label.find("-tree-");
+        if (tree == std::string::npos || !hash_algo_from_name(label.substr(0, tree).c_str(), &entry->algo)) {
+            return false;
+        }
+        const u32 kib = (u32)atoi(label.c_str() + tree + 6);
+        if (kib == 0 || tree_hash_label(entry->algo, (usize)kib * 1024) != label) {
+            return false;
+        }
+        entry->tree_leaf_size = (usize)kib * 1024;
+        entry->expected = label + ":";
+    } else if (hex.size() == hash_digest_size(HashAlgo::MD5) * 2) {
+        entry->algo = HashAlgo::MD5;
+    } else if (hex.size() == hash_digest_size(HashAlgo::SHA256) * 2) {
+        entry->algo = HashAlgo::SHA256;
+    } else {
+        return false;
+    }
+    if (hex.size() != hash_digest_size(entry->algo) * 2) {
+        return false;
+    }
+    entry->expected += hex;
+    return !entry->path.empty();
+}
+
+class CheckJobs {
+private:
+    ThreadPool* pool;
+    usize max_in_flight;
+
+    std::mutex lock;
+    std::condition_variable slot_free;
+    usize in_flight;
+public:
+    usize failed;
+    usize unreadable;
+
+    CheckJobs(ThreadPool* pool) : pool(pool), in_flight(0), failed(0), unreadable(0) {
+        max_in_flight = pool->size() * CHECK_JOBS_PER_THREAD;
+    }
+
+    // Blocks while max_in_flight files are already being checked
+    void check(CheckEntry entry) {
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            slot_free.wait(lk, [this]() { return in_flight < max_in_flight; });
+            in_flight += 1;
+        }
+
+        if (entry.tree_leaf_size > 0) {
+            const std::string label = tree_hash_label(entry.algo, entry.tree_leaf_size) + ":";
+            tree_hash_file(pool, entry.path, entry.algo, entry.tree_leaf_size, [this, entry, label](bool ok, const HashDigest& root) {
+                finish(entry, ok, label + to_hex(root));
+            });
+            return;
+        }
+        pool->submit([this, entry]() {
+            HashDigest digest = HashDigest();
+            const bool ok = hash_file(entry.path.c_str(), entry.algo, &digest);
+            finish(entry, ok, to_hex(digest));
+        });
+    }
+private:
+    void finish(const CheckEntry& entry, bool ok, const std::string& actual) {
+        std::lock_guard<std::mutex> lk(lock);
+        if (!ok) {
+            printf("%s: FAILED open or read\n", entry.path.c_str());
+            unreadable += 1;
+        } else if (actual != entry.expected) {
+            printf("%s: FAILED\n", entry.path.c_str());
+            failed += 1;
+        } else {
+            printf("%s: OK\n", entry.path.c_str());
+        }
+        in_flight -= 1;
+        slot_free.notify_one();
+    }
+};
+
+static int run_check(ThreadPool* pool, const char* manifest) {
+    const bool from_stdin = strcmp(manifest, "-") == 0;
+    std::FILE* f = from_stdin ? stdin : std::fopen(manifest, "rb");
+    if (f == nullptr) {
+        fprintf(stderr, "Failed to read %s\n", manifest);
+        return EXIT_FAILURE;
+    }
+
+    // Entries are handed to the pool while the manifest is still being read
+    CheckJobs jobs = CheckJobs(pool);
+    usize malformed = 0;
+    usize entries = 0;
+    std::string line;
+    char buf[4096];
+    while (std::fgets(buf, sizeof(buf), f) != nullptr) {
+        line += buf;
+        if (line.back() != '\n' && !std::feof(f)) {
+            continue;
+        }
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        CheckEntry entry = CheckEntry();
+        if (!line.empty() && line[0] != '#') {
+            if (parse_check_line(line, &entry)) {
+                jobs.check(std::move(entry));
+                entries += 1;
+            } else {
+                malformed += 1;
+            }
+        }
+        line.clear();
+    }
+    const bool read_error = std::ferror(f);
+    if (!from_stdin) {
+        std::fclose(f);
+    }
+    pool->wait();
+
+    if (read_error) {
+        fprintf(stderr, "Failed to read %s\n", manifest);
+    }
+    if (malformed > 0) {
+        fprintf(stderr, "WARNING: %u lines are improperly formatted\n", (u32)malformed);
+    }
+    if (jobs.unreadable > 0) {
+        fprintf(stderr, "WARNING: %u listed files could not be read\n", (u32)jobs.unreadable);
+    }
+    if (jobs.failed > 0) {
+        fprintf(stderr, "WARNING: %u computed checksums did NOT match\n", (u32)jobs.failed);
+    }
+    if (entries == 0) {
+        fprintf(stderr, "%s: no properly formatted checksum lines found\n", manifest);
+    }
+    const bool ok = !read_error && entries > 0 && jobs.failed == 0 && jobs.unreadable == 0;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, const char* argv[]) {
+    HashAlgo algo = HashAlgo::MD5;
+    bool recursive = false;
+    bool dedupe = false;
+    bool tree = false;
+    bool uring = false;
+    usize leaf_size = TREE_LEAF_SIZE;
+    const char* verify = nullptr;
+    const char* manifest = nullptr;
+    usize threads = 0;
+    const char* cache_path = nullptr;
+    std::vector<const char*> inputs = std::vector<const char*>();
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            if (!hash_algo_from_name(argv[++i], &algo)) {
+                fprintf(stderr, "Unknown algorithm %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            recursive = true;
+        } else if (strcmp(argv[i], "--dedupe") == 0) {
+            dedupe = true;
+        } else if (strcmp(argv[i], "--uring") == 0) {
+            uring = true;
+        } else if (strcmp(argv[i], "--tree") == 0) {
+            tree = true;
+        } else if (strcmp(argv[i], "--leaf-size") == 0 && i + 1 < argc) {
+            leaf_size = (usize)max(1, atoi(argv[++i])) * 1024;
+        } else if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+            verify = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (usize)max(1, atoi(argv[++i]));
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (inputs.empty() == (manifest == nullptr)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    ThreadPool pool = ThreadPool(threads);
+    if (manifest != nullptr) {
+        return run_check(&pool, manifest);
+    }
+    if (dedupe) {
+        return run_dedupe(&pool, algo, inputs);
+    }
+
+    HashOptions options = HashOptions();
+    options.algo = algo;
+    options.recursive = recursive;
+    options.tree_leaf_size = tree ? leaf_size : 0;
+    options.uring = uring;
+    if (uring && !UringReader().init()) {
+        fprintf(stderr, "io_uring is unavailable, using blocking reads\n");
+        options.uring = false;
+    }
+    for (const char* c = verify; c != nullptr && *c != '\0'; ++c) {
+        options.verify.push_back(str::tolower(*c));
+    }
+
+    if (tree && cache_path != nullptr) {
+        fprintf(stderr, "Tree digests aren't cached, ignoring --cache\n");
+        cache_path = nullptr;
+    }
+    HashCache cache;
+    if (cache_path != nullptr && !cache.open(cache_path)) {
+        // Not ours to overwrite
+        fprintf(stderr, "%s isn't a hash cache, not using it\n", cache_path);
+        cache_path = nullptr;
+    }
+
+    const int status = run_hash(&pool, options, inputs, cache_path ? &cache : nullptr);
+
+    if (cache_path != nullptr && !cache.save()) {
+        fprintf(stderr, "Failed to write hash cache %s\n", cache_path);
+    }
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return status;
+}
@@ -4,19 +4,206 @@
 #include <SDL.h>
 
 #include "hk.hh"
+#include "rectpack.hh"
 
 #include "imgui.h"
 #include "backends/imgui_impl_sdl2.h"
 #include "backends/imgui_impl_sdlrenderer2.h"
 
-#include <algorithm> // std::sort
-
 using namespace hk;
 
 static inline f32 now() {
     return (f32)SDL_GetTicks() / 1e3f;
 }
 
+// ==============================
+// View
+// ==============================
+
+// Bin to screen: screen = origin + (bin - pan) * zoom
+struct View {
+    ImVec2 origin;
+    ImVec2 pan;
+    f32 zoom;
+
+    ImVec2 to_screen(f32 x, f32 y) const {
+        return ImVec2(origin.x + (x - pan.x) * zoom, origin.y + (y - pan.y) * zoom);
+    }
+
+    ImVec2 to_bin(ImVec2 p) const {
+        return ImVec2(pan.x + (p.x - origin.x) / zoom, pan.y + (p.y - origin.y) / zoom);
+    }
+};
+
+// The rects of one bin bucketed by the grid cell their top-left corner is in, so only the cells in view are
+// visited, and the share of each cell the rects cover, drawn instead of the rects when they'd be specks
+class RectIndex {
+private:
+    u32 cell_size = 1;
+    u32 cells_x = 0;
+    u32 cells_y = 0;
+    u32 max_w = 0;
+    u32 max_h = 0;
+    f32 avg_side = 0.0f;
+    // Rect indices of cell c are items[start[c]..start[c + 1]]
+    std::vector<u32> start;
+    std::vector<u32> items;
+    std::vector<f32> coverage;
+public:
+    void build(Span<const PackRect> rects, u32 bin_w, u32 bin_h, bool any_bin, u32 bin) {
+        u64 area = 0;
+        u32 count = 0;
+        max_w = 0;
+        max_h = 0;
+        for (const PackRect& r : rects) {
+            if (r.packed && (any_bin || r.bin == bin)) {
+                area += (u64)r.w * r.h;
+                count += 1;
+                max_w = max(max_w, r.w);
+                max_h = max(max_h, r.h);
+            }
+        }
+        avg_side = count > 0 ? (f32)std::sqrt((f64)area / count) : 0.0f;
+        // About one rect per cell, at most 256 x 256 cells
+        cell_size = max<u32>(1, max<u32>((u32)avg_side, max(bin_w, bin_h) / 256 + 1));
+        cells_x = bin_w / cell_size + 1;
+        cells_y = bin_h / cell_size + 1;
+
+        start.assign((usize)cells_x * cells_y + 1, 0);
+        coverage.assign((usize)cells_x * cells_y, 0.0f);
+        for (const PackRect& r : rects) {
+            if (r.packed && (any_bin || r.bin == bin)) {
+                start[cell_of(r.x, r.y) + 1] += 1;
+                add_coverage(r);
+            }
+        }
+        for (usize c = 0; c + 1 < start.size(); ++c) {
+            start[c + 1] += start[c];
+        }
+        items.resize(count);
+        std::vector<u32> next = std::vector<u32>(start.begin(), start.end() - 1);
+        for (u32 i = 0; i < (u32)rects.size(); ++i) {
+            const PackRect& r = rects[i];
+            if (r.packed && (any_bin || r.bin == bin)) {
+                items[next[cell_of(r.x, r.y)]++] = i;
+            }
+        }
+    }
+
+    f32 average_side() const {
+        return avg_side;
+    }
+
+    // fn(index) for every rect that can reach into [x0, x1) x [y0, y1), and how many were visited
+    template <typename Fn>
+    u32 query(f32 x0, f32 y0, f32 x1, f32 y1, Fn&& fn) const {
+        if (cells_x == 0) {
+            return 0;
+        }
+        // A rect starting up to its largest size left of or above the view can still reach into it
+        const u32 cx0 = clamp_cell(x0 - max_w, cells_x);
+        const u32 cy0 = clamp_cell(y0 - max_h, cells_y);
+        const u32 cx1 = clamp_cell(x1, cells_x);
+        const u32 cy1 = clamp_cell(y1, cells_y);
+        u32 visited = 0;
+        for (u32 cy = cy0; cy <= cy1; ++cy) {
+            for (u32 cx = cx0; cx <= cx1; ++cx) {
+                const usize c = (usize)cy * cells_x + cx;
+                for (u32 k = start[c]; k < start[c + 1]; ++k) {
+                    fn(items[k]);
+                }
+                visited += start[c + 1] - start[c];
+            }
+        }
+        return visited;
+    }
+
+    // fn(x, y, size, covered share) for every cell in view with rects in it
+    template <typename Fn>
+    void query_coverage(f32 x0, f32 y0, f32 x1, f32 y1, Fn&& fn) const {
+        if (cells_x == 0) {
+            return;
+        }
+        for (u32 cy = clamp_cell(y0, cells_y); cy <= clamp_cell(y1, cells_y); ++cy) {
+            for (u32 cx = clamp_cell(x0, cells_x); cx <= clamp_cell(x1, cells_x); ++cx) {
+                const f32 share = coverage[(usize)cy * cells_x + cx];
+                if (share > 0.0f) {
+                    fn(cx * cell_size, cy * cell_size, cell_size, share);
+                }
+            }
+        }
+    }
+private:
+    usize cell_of(u32 x, u32 y) const {
+        return (usize)min(y / cell_size, cells_y - 1) * cells_x + min(x / cell_size, cells_x - 1);
+    }
+
+    u32 clamp_cell(f32 v, u32 cells) const {
+        return (u32)clamp(v / (f32)cell_size, 0.0f, (f32)(cells - 1));
+    }
+
+    void add_coverage(const PackRect& r) {
+        if (r.w == 0 || r.h == 0) {
+            return;
+        }
+        const f32 cell_area = (f32)cell_size * cell_size;
+        for (u32 cy = r.y / cell_size; cy <= min((r.y + r.h - 1) / cell_size, cells_y - 1); ++cy) {
+            for (u32 cx = r.x / cell_size; cx <= min((r.x + r.w - 1) / cell_size, cells_x - 1); ++cx) {
+                const u32 w = min(r.x + r.w, (cx + 1) * cell_size) - max(r.x, cx * cell_size);
+                const u32 h = min(r.y + r.h, (cy + 1) * cell_size) - max(r.y, cy * cell_size);
+                coverage[(usize)cy * cells_x + cx] += (f32)w * h / cell_area;
+            }
+        }
+    }
+};
+
+// Colored quads, all drawn with one SDL_RenderGeometry call instead of an ImGui draw command each
+class RectBatch {
+private:
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+public:
+    void clear() {
+        vertices.clear();
+        indices.clear();
+    }
+
+    void fill(ImVec2 p1, ImVec2 p2, ImU32 color) {
+        const SDL_Color c = {
+            (u8)(color >> IM_COL32_R_SHIFT), (u8)(color >> IM_COL32_G_SHIFT),
+            (u8)(color >> IM_COL32_B_SHIFT), (u8)(color >> IM_COL32_A_SHIFT)
+        };
+        const int base = (int)vertices.size();
+        vertices.push_back({ { p1.x, p1.y }, c, { 0.0f, 0.0f } });
+        vertices.push_back({ { p2.x, p1.y }, c, { 0.0f, 0.0f } });
+        vertices.push_back({ { p2.x, p2.y }, c, { 0.0f, 0.0f } });
+        vertices.push_back({ { p1.x, p2.y }, c, { 0.0f, 0.0f } });
+        const int quad[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+        indices.insert(indices.end(), quad, quad + 6);
+    }
+
+    // One pixel wide edges inside the rect; rects too small to have an inside are filled
+    void outline(ImVec2 p1, ImVec2 p2, ImU32 color) {
+        if (p2.x - p1.x < 3.0f || p2.y - p1.y < 3.0f) {
+            fill(p1, ImVec2(max(p2.x, p1.x + 1.0f), max(p2.y, p1.y + 1.0f)), color);
+            return;
+        }
+        fill(p1, ImVec2(p2.x, p1.y + 1.0f), color);
+        fill(ImVec2(p1.x, p2.y - 1.0f), p2, color);
+        fill(ImVec2(p1.x, p1.y + 1.0f), ImVec2(p1.x + 1.0f, p2.y - 1.0f), color);
+        fill(ImVec2(p2.x - 1.0f, p1.y + 1.0f), ImVec2(p2.x, p2.y - 1.0f), color);
+    }
+
+    void draw(SDL_Renderer* renderer, const SDL_Rect& clip) const {
+        if (indices.empty()) {
+            return;
+        }
+        SDL_RenderSetClipRect(renderer, &clip);
+        SDL_RenderGeometry(renderer, nullptr, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+        SDL_RenderSetClipRect(renderer, nullptr);
+    }
+};
+
 int main(int argc, const char* argv[]) {
     SDL_version sdlv_l; SDL_GetVersion(&sdlv_l);
     SDL_version sdlv_c; SDL_VERSION(&sdlv_c);
@@ -71,196 +258,322 @@ int main(int argc, const char* argv[]) {
         ImGui::NewFrame();
 
         //
-        struct Rect {
-            Vec2 pos;
-            Vec2 size;
-            ImColor color;
-        };
-        //
-        static std::vector<Rect> rects_original = { };
-        static std::vector<Rect> rects = { };
+        static std::vector<PackRect> rects_original = { };
+        static std::vector<PackRect> rects = { };
+        static std::vector<ImColor> rect_colors = { };
         static f32 rects_gen_time = 0;
         //
         static RandomXOR rng = RandomXOR();
         static u32 gen_count = 20;
         static u32 gen_min_size = 25;
         static u32 gen_max_size = 150;
+        static Distribution gen_distribution = Distribution::UNIFORM;
+        static u32 gen_seed = 1;
         static u32 canvas_w = 512;
         static u32 canvas_h = 512;
         //
-        const char* methods[] = {
-            "Noob method",
-            "Noob method (sorted by area)",
-            "Noob method (reverse sorted by area)",
-            "Noob method (sorted by height)",
-        };
-        static usize selected_method = 0;
+        static PackerKind selected_packer = PackerKind::SHELF;
+        static SortOrder selected_order = SortOrder::NONE;
         static bool did_pack_at_least_once = false;
+        static PackStats stats = PackStats();
+        static PackCheck check = PackCheck();
+        static ThreadPool pool = ThreadPool();
+        static bool solve_rotate = true;
+        static bool may_rotate = false;
+        static bool did_solve = false;
+        static PackCandidate solved = PackCandidate();
+        static BinStrategy selected_strategy = BinStrategy::DISTRIBUTE;
+        static u32 bins = 0;
+        static i32 page = 0;
+        //
+        static bool live_atlas = false;
+        static std::unique_ptr<AtlasAllocator> atlas = nullptr;
+        static std::vector<u32> atlas_ids = { };
+        static std::vector<ImColor> atlas_colors = { };
+        static u32 atlas_failed = 0;
+        static u32 atlas_moves = 0;
+        //
+        static View view = { ImVec2(0.0f, 0.0f), ImVec2(0.0f, 0.0f), 1.0f };
+        static RectIndex index = RectIndex();
+        static i32 index_page = -1;
+        static RectBatch batch = RectBatch();
+        static SDL_Rect canvas_clip = SDL_Rect();
+        static u32 drawn = 0;
 
 
         ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
         ImGui::SetNextWindowSize(ImGui::GetMainViewport()->Size);
-        if (ImGui::Begin("Main", NULL, ImGuiWindowFlags_NoDecoration)) {
+        batch.clear();
+        // No background, so the batch drawn before the UI shows through on the canvas
+        if (ImGui::Begin("Main", NULL, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoScrollWithMouse)) {
             ImGui::Columns(2);
             ImGui::InputInt("Count", (int*)&gen_count);
             ImGui::InputInt("Minimum size", (int*)&gen_min_size);
             ImGui::InputInt("Maximum size", (int*)&gen_max_size);
-            
-            if (rects.size() == 0 || ImGui::Button("New inputs")) {
-                rects.clear();
+            if (ImGui::BeginCombo("Distribution", distribution_name(gen_distribution))) {
+                for (u8 i = 0; i < (u8)Distribution::COUNT; ++i) {
+                    if (ImGui::Selectable(distribution_name((Distribution)i), (Distribution)i == gen_distribution)) {
+                        gen_distribution = (Distribution)i;
+                    }
+                    if ((Distribution)i == gen_distribution) {
+                        ImGui::SetItemDefaultFocus();
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            ImGui::InputInt("Seed", (int*)&gen_seed);
+
+            const bool regenerate = rects.size() == 0;
+            if (ImGui::Button("New inputs") || regenerate) {
+                // The same seed gives the same inputs, so a layout can be looked at again later
+                if (!regenerate) {
+                    gen_seed += 1;
+                }
+                rects = generate_rects({ gen_distribution, gen_count, gen_min_size, gen_max_size, gen_seed });
+                rect_colors.clear();
                 for (u32 i = 0; i < gen_count; ++i) {
-                    Rect r = Rect();
-                    r.size = Vec2(
-                        rng.random<f32>(gen_min_size, gen_max_size),
-                        rng.random<f32>(gen_min_size, gen_max_size)
-                    );
-                    r.color = ImColor(
+                    rect_colors.push_back(ImColor(
                         rng.random<f32>(0.0f, 1.0f),
                         rng.random<f32>(0.0f, 1.0f),
                         rng.random<f32>(0.0f, 1.0f)
-                    );
-                    rects.push_back(r);
+                    ));
                 }
                 rects_gen_time = now();
+                for (PackRect& r : rects) {
+                    r.may_rotate = may_rotate;
+                }
                 rects_original = rects;
+                did_pack_at_least_once = false;
             }
             ImGui::SameLine();
             ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 1.0f, max(0.0f, 1.0f - ((now() - rects_gen_time) / 2.0f))));
-            ImGui::Text("Generated %d rects", (u32)rects.size());
+            ImGui::Text("Generated %d rects, seed %u", (u32)rects.size(), gen_seed);
             ImGui::PopStyleColor();
 
             ImGui::InputInt("Canvas width", (int*)&canvas_w);
             ImGui::InputInt("Canvas height", (int*)&canvas_h);
-            if (ImGui::BeginCombo("Method", methods[selected_method])) {
-                for (usize i = 0; i < arrlen(methods); ++i) {
-                    if (ImGui::Selectable(methods[i], i == selected_method)) {
-                        selected_method = i;
+            if (ImGui::BeginCombo("Packer", packer_name(selected_packer))) {
+                for (u8 i = 0; i < (u8)PackerKind::COUNT; ++i) {
+                    if (ImGui::Selectable(packer_name((PackerKind)i), (PackerKind)i == selected_packer)) {
+                        selected_packer = (PackerKind)i;
                     }
-                    if (i == selected_method) {
+                    if ((PackerKind)i == selected_packer) {
                         ImGui::SetItemDefaultFocus();
                     }
                 }
                 ImGui::EndCombo();
             }
+            if (ImGui::BeginCombo("Sort order", sort_order_name(selected_order))) {
+                for (u8 i = 0; i < (u8)SortOrder::COUNT; ++i) {
+                    if (ImGui::Selectable(sort_order_name((SortOrder)i), (SortOrder)i == selected_order)) {
+                        selected_order = (SortOrder)i;
+                    }
+                    if ((SortOrder)i == selected_order) {
+                        ImGui::SetItemDefaultFocus();
+                    }
+                }
+                ImGui::EndCombo();
+            }
+
+            if (ImGui::Checkbox("May rotate", &may_rotate)) {
+                for (PackRect& r : rects_original) {
+                    r.may_rotate = may_rotate;
+                }
+            }
 
             if (ImGui::Button("Pack")) {
                 rects = rects_original;
-                switch (selected_method) {
-                case 0: {
-                    f32 x_cur = 0;
-                    f32 y_cur = 0;
-                    f32 y_step = 0;
-                    for (auto& rect : rects) {
-                        if (x_cur + rect.size.x >= canvas_w) {
-                            y_cur += y_step;
-                            y_step = 0;
-                            x_cur = 0;
-                        }
-                        y_step = max(y_step, rect.size.y);
-                        rect.pos.x = x_cur;
-                        rect.pos.y = y_cur;
-                        x_cur += rect.size.x;
-                    }
-                } break;
-                case 1: {
-                    std::sort(rects.begin(), rects.end(), [](const Rect& left, const Rect& right) {
-                        return left.size.x * left.size.y < right.size.x * right.size.y;
-                    });
-
-                    f32 x_cur = 0;
-                    f32 y_cur = 0;
-                    f32 y_step = 0;
-                    for (auto& rect : rects) {
-                        if (x_cur + rect.size.x >= canvas_w) {
-                            y_cur += y_step;
-                            y_step = 0;
-                            x_cur = 0;
-                        }
-                        y_step = max(y_step, rect.size.y);
-                        rect.pos.x = x_cur;
-                        rect.pos.y = y_cur;
-                        x_cur += rect.size.x;
+                sort_rects(rects, selected_order);
+                make_packer(selected_packer)->pack(canvas_w, canvas_h, rects);
+                sort_rects_by_id(rects);
+                stats = pack_stats(canvas_w, canvas_h, rects);
+                check = check_packing(canvas_w, canvas_h, rects);
+                did_pack_at_least_once = true;
+                index_page = -1;
+                did_solve = false;
+                bins = 0;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Pack bins")) {
+                rects = rects_original;
+                bins = pack_bins(&pool, canvas_w, canvas_h, rects, { selected_packer, selected_order, selected_strategy });
+                stats = pack_stats(canvas_w, canvas_h, rects);
+                check = check_packing(canvas_w, canvas_h, rects);
+                did_pack_at_least_once = true;
+                index_page = -1;
+                did_solve = false;
+                page = 0;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Solve")) {
+                SolveOptions options = SolveOptions();
+                options.rotate = solve_rotate;
+                SolveResult result = solve_pack(&pool, canvas_w, canvas_h, rects_original, options);
+                rects.swap(result.rects);
+                stats = result.stats;
+                solved = result.best;
+                check = check_packing(canvas_w, canvas_h, rects);
+                did_pack_at_least_once = true;
+                index_page = -1;
+                did_solve = true;
+                bins = 0;
+            }
+            ImGui::SameLine();
+            // Orientations only turn rects that may rotate
+            ImGui::BeginDisabled(!may_rotate);
+            ImGui::Checkbox("Try orientations", &solve_rotate);
+            ImGui::EndDisabled();
+            if (ImGui::BeginCombo("Bin strategy", bin_strategy_name(selected_strategy))) {
+                for (u8 i = 0; i < (u8)BinStrategy::COUNT; ++i) {
+                    if (ImGui::Selectable(bin_strategy_name((BinStrategy)i), (BinStrategy)i == selected_strategy)) {
+                        selected_strategy = (BinStrategy)i;
                     }
-                } break;
-                case 2: {
-                    std::sort(rects.begin(), rects.end(), [](const Rect& left, const Rect& right) {
-                        return left.size.x * left.size.y > right.size.x * right.size.y;
-                    });
-
-                    f32 x_cur = 0;
-                    f32 y_cur = 0;
-                    f32 y_step = 0;
-                    for (auto& rect : rects) {
-                        if (x_cur + rect.size.x >= canvas_w) {
-                            y_cur += y_step;
-                            y_step = 0;
-                            x_cur = 0;
-                        }
-                        y_step = max(y_step, rect.size.y);
-                        rect.pos.x = x_cur;
-                        rect.pos.y = y_cur;
-                        x_cur += rect.size.x;
+                    if ((BinStrategy)i == selected_strategy) {
+                        ImGui::SetItemDefaultFocus();
                     }
-                } break;
-                case 3: {
-                    std::sort(rects.begin(), rects.end(), [](const Rect& left, const Rect& right) {
-                        return left.size.y < right.size.y;
-                    });
+                }
+                ImGui::EndCombo();
+            }
+            if (bins > 0) {
+                ImGui::SliderInt("Bin", &page, 0, (i32)bins - 1);
+                ImGui::Text("%u bins", bins);
+            }
+            if (did_solve) {
+                ImGui::Text("Best: %s, %s, %s", packer_name(solved.packer), sort_order_name(solved.order), orientation_name(solved.orientation));
+            }
+            if (did_pack_at_least_once) {
+                ImGui::Text("Packed %u of %u, %.2f%% occupancy", stats.packed, stats.count, stats.occupancy * 100.0);
+                if (stats.packed < stats.count) {
+                    ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%u rects didn't fit", stats.count - stats.packed);
+                }
+                if (check.out_of_bounds > 0) {
+                    ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%u rects left the canvas", check.out_of_bounds);
+                }
+                if (check.overlap_a != UINT32_MAX) {
+                    ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "#%u and #%u overlap", check.overlap_a + 1, check.overlap_b + 1);
+                }
+            }
 
-                    f32 x_cur = 0;
-                    f32 y_cur = 0;
-                    f32 y_step = 0;
-                    for (auto& rect : rects) {
-                        if (x_cur + rect.size.x >= canvas_w) {
-                            y_cur += y_step;
-                            y_step = 0;
-                            x_cur = 0;
-                        }
-                        y_step = max(y_step, rect.size.y);
-                        rect.pos.x = x_cur;
-                        rect.pos.y = y_cur;
-                        x_cur += rect.size.x;
+            ImGui::Separator();
+            if (ImGui::Checkbox("Live atlas", &live_atlas) || (live_atlas && atlas == nullptr)) {
+                atlas.reset(new AtlasAllocator(canvas_w, canvas_h));
+                atlas_ids.clear();
+                atlas_failed = 0;
+                atlas_moves = 0;
+            }
+            if (live_atlas) {
+                if (ImGui::Button("Insert")) {
+                    const u32 id = atlas->allocate(rng.random<u32>(gen_min_size, gen_max_size), rng.random<u32>(gen_min_size, gen_max_size));
+                    if (id != AtlasAllocator::INVALID) {
+                        atlas_ids.push_back(id);
+                        atlas_colors.resize(max<usize>(atlas_colors.size(), id + 1));
+                        atlas_colors[id] = ImColor(rng.random<f32>(0.0f, 1.0f), rng.random<f32>(0.0f, 1.0f), rng.random<f32>(0.0f, 1.0f));
+                    } else {
+                        atlas_failed += 1;
                     }
-                } break;
                 }
-
-                did_pack_at_least_once = true;
+                ImGui::SameLine();
+                if (ImGui::Button("Free random") && !atlas_ids.empty()) {
+                    const u32 k = rng.next() % (u32)atlas_ids.size();
+                    atlas->free(atlas_ids[k]);
+                    atlas_ids[k] = atlas_ids.back();
+                    atlas_ids.pop_back();
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Defragment")) {
+                    atlas_moves = (u32)atlas->defragment().size();
+                }
+                const AtlasAllocator::Stats atlas_stats = atlas->stats();
+                ImGui::Text("%u live, %u free rects, %.1f%% fragmented", atlas_stats.allocations, atlas_stats.free_rects, atlas_stats.fragmentation * 100.0);
+                ImGui::Text("%u inserts didn't fit, last defragment moved %u", atlas_failed, atlas_moves);
             }
 
             ImGui::SetColumnWidth(0, 300.0f);
             ImGui::NextColumn();
-            ImGui::Text("%ux%u", (u32)canvas_w, (u32)canvas_h);
-
-            ImVec2 cur = ImGui::GetCursorPos();
-
-            ImGui::GetForegroundDrawList()->AddRect(
-                ImVec2(cur.x - 1, cur.y - 1),
-                ImVec2(cur.x + canvas_w + 1, cur.y + canvas_h + 1),
-                ImColor(0.1f, 1.0f, 0.1f)
-            );
+            ImGui::Text("%ux%u, %.0f%%, %u drawn", (u32)canvas_w, (u32)canvas_h, view.zoom * 100.0f, drawn);
+            ImGui::SameLine();
+            const ImVec2 avail = ImGui::GetContentRegionAvail();
+            if (ImGui::SmallButton("Fit")) {
+                view.pan = ImVec2(0.0f, 0.0f);
+                view.zoom = min(avail.x / max(1u, canvas_w), (avail.y - ImGui::GetFrameHeightWithSpacing()) / max(1u, canvas_h));
+            }
+            ImGui::SameLine();
+            if (ImGui::SmallButton("1:1")) {
+                view.pan = ImVec2(0.0f, 0.0f);
+                view.zoom = 1.0f;
+            }
 
-            if (did_pack_at_least_once) {
-                for (usize i = 0; i < rects.size(); ++i) {
-                    const Rect& rect = rects[i];
-                    ImVec2 p1 = ImVec2(cur.x + rect.pos.x, cur.y + rect.pos.y);
-                    ImVec2 p2 = ImVec2(p1.x + rect.size.x, p1.y + rect.size.y);
-                    ImGui::GetForegroundDrawList()->AddRect(p1, p2, rect.color);
-                    ImVec2 t = ImVec2(p1.x + 5, p1.y + 5);
-                    char buf[64]; snprintf(buf, sizeof(buf), "#%u", (u32)i + 1);
-                    u32 color = IM_COL32_WHITE;
-                    if (rect.pos.x + rect.size.x >= canvas_w || rect.pos.y + rect.size.y >= canvas_h) {
-                        color = IM_COL32(0xFF, 0x00, 0x00, 0xFF);
-                    }
-                    ImGui::GetForegroundDrawList()->AddText(t, color, buf);
+            // Drag to pan, wheel to zoom around the mouse
+            view.origin = ImGui::GetCursorScreenPos();
+            const ImVec2 size = ImVec2(max(1.0f, ImGui::GetContentRegionAvail().x), max(1.0f, ImGui::GetContentRegionAvail().y));
+            ImGui::InvisibleButton("canvas", size, ImGuiButtonFlags_MouseButtonLeft | ImGuiButtonFlags_MouseButtonMiddle);
+            const ImGuiIO& io = ImGui::GetIO();
+            if (ImGui::IsItemActive()) {
+                view.pan.x -= io.MouseDelta.x / view.zoom;
+                view.pan.y -= io.MouseDelta.y / view.zoom;
+            }
+            if (ImGui::IsItemHovered() && io.MouseWheel != 0.0f) {
+                const ImVec2 anchor = view.to_bin(io.MousePos);
+                view.zoom = clamp(view.zoom * std::pow(1.25f, io.MouseWheel), 1.0f / 1024.0f, 256.0f);
+                view.pan = ImVec2(anchor.x - (io.MousePos.x - view.origin.x) / view.zoom, anchor.y - (io.MousePos.y - view.origin.y) / view.zoom);
+            }
+            canvas_clip = { (int)view.origin.x, (int)view.origin.y, (int)size.x, (int)size.y };
+            ImDrawList* draw_list = ImGui::GetWindowDrawList();
+            draw_list->PushClipRect(view.origin, ImVec2(view.origin.x + size.x, view.origin.y + size.y), true);
+
+            const ImVec2 bin_p1 = view.to_screen(0.0f, 0.0f);
+            const ImVec2 bin_p2 = view.to_screen((f32)canvas_w, (f32)canvas_h);
+            draw_list->AddRect(ImVec2(bin_p1.x - 1, bin_p1.y - 1), ImVec2(bin_p2.x + 1, bin_p2.y + 1), ImColor(0.1f, 1.0f, 0.1f));
+
+            // The part of the bin in view
+            const ImVec2 view_p1 = view.to_bin(view.origin);
+            const ImVec2 view_p2 = view.to_bin(ImVec2(view.origin.x + size.x, view.origin.y + size.y));
+            drawn = 0;
+            if (live_atlas) {
+                for (u32 id : atlas_ids) {
+                    const AtlasAllocator::Allocation& a = atlas->get(id);
+                    batch.outline(view.to_screen((f32)a.x, (f32)a.y), view.to_screen((f32)(a.x + a.w), (f32)(a.y + a.h)), atlas_colors[id]);
+                }
+                drawn = (u32)atlas_ids.size();
+            } else if (did_pack_at_least_once) {
+                if (index_page != (bins > 0 ? page : 0)) {
+                    index_page = bins > 0 ? page : 0;
+                    index.build(rects, canvas_w, canvas_h, bins == 0, (u32)index_page);
+                }
 
+                // Far out, where rects would be a pixel or two, each grid cell is shaded by how much of it is covered
+                if (index.average_side() * view.zoom < 2.0f) {
+                    index.query_coverage(view_p1.x, view_p1.y, view_p2.x, view_p2.y, [&](u32 x, u32 y, u32 side, f32 share) {
+                        const u8 shade = (u8)(40.0f + 215.0f * min(1.0f, share));
+                        batch.fill(view.to_screen((f32)x, (f32)y), view.to_screen((f32)(x + side), (f32)(y + side)), IM_COL32(shade, shade, shade, 255));
+                    });
+                } else {
+                    // Labels only where they fit, and not so many that text is all that's drawn
+                    const bool labels = index.average_side() * view.zoom >= 32.0f;
+                    index.query(view_p1.x, view_p1.y, view_p2.x, view_p2.y, [&](u32 i) {
+                        const PackRect& rect = rects[i];
+                        if (rect.x > view_p2.x || rect.y > view_p2.y || rect.x + rect.w < view_p1.x || rect.y + rect.h < view_p1.y) {
+                            return;
+                        }
+                        const ImVec2 p1 = view.to_screen((f32)rect.x, (f32)rect.y);
+                        const ImVec2 p2 = view.to_screen((f32)(rect.x + rect.w), (f32)(rect.y + rect.h));
+                        batch.outline(p1, p2, rect_colors[rect.id]);
+                        drawn += 1;
+                        if (labels && p2.x - p1.x >= 32.0f && p2.y - p1.y >= 20.0f) {
+                            char buf[64]; snprintf(buf, sizeof(buf), "#%u%s", rect.id + 1, rect.rotated ? " r" : "");
+                            draw_list->AddText(ImVec2(p1.x + 5, p1.y + 5), IM_COL32_WHITE, buf);
+                        }
+                    });
                 }
             }
+            draw_list->PopClipRect();
 
             ImGui::NextColumn();
             ImGui::End();
         }
 
         ImGui::Render();
+        batch.draw(r, canvas_clip);
         ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
         SDL_RenderPresent(r);
 
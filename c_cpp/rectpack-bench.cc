@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: MIT
+
+// Time and occupancy of every packer and sort order on random inputs, then multi-bin packing of up to ten times as
+// many rects, then the online allocator under churn. Every packing is checked for overlaps, untimed.
+//
+// With --corpus, packs each corpus distribution and rect list dump into bins with every packer, without and with
+// rotation, instead, and reports time, occupancy, bins and peak heap use, optionally as JSON for tracking over time.
+
+#include "hk.hh"
+#include "rectpack.hh"
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+using namespace hk;
+
+// ==============================
+// Heap tracking
+// ==============================
+
+// Every allocation carries its size in front, so the bench can tell how much heap a packer holds at its peak
+static std::atomic<i64> heap_live = { 0 };
+static std::atomic<i64> heap_peak = { 0 };
+
+static constexpr usize HEAP_HEADER = alignof(std::max_align_t);
+
+void* operator new(usize size) {
+    u8* p = (u8*)std::malloc(size + HEAP_HEADER);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    *(usize*)p = size;
+    const i64 live = heap_live.fetch_add((i64)size) + (i64)size;
+    i64 peak = heap_peak.load();
+    while (live > peak && !heap_peak.compare_exchange_weak(peak, live)) { }
+    return p + HEAP_HEADER;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr != nullptr) {
+        // Through an integer, as GCC otherwise takes the header for an out of bounds read of whatever was freed
+        void* p = (void*)((uintptr_t)ptr - HEAP_HEADER);
+        heap_live.fetch_sub((i64)*(usize*)p);
+        std::free(p);
+    }
+}
+
+void* operator new[](usize size) {
+    return operator new(size);
+}
+
+void operator delete[](void* ptr) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, usize) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, usize) noexcept {
+    operator delete(ptr);
+}
+
+// ==============================
+// Bench
+// ==============================
+
+static f64 seconds() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: rectpack-bench [options]\n"
+        "\n"
+        "Options:\n"
+        "  --max-count <n>   Largest number of rects (default: 100000)\n"
+        "  --min-size <n>    Smallest rect side (default: 25)\n"
+        "  --max-size <n>    Largest rect side (default: 150)\n"
+        "  --bin-size <n>    Bin side for multi-bin packing (default: 2048)\n"
+        "  --seed <n>        Corpus seed (default: 1)\n"
+        "\n"
+        "Corpus options:\n"
+        "  --corpus          Run the corpus instead of the tables above\n"
+        "  --count <n>       Rects per distribution (default: 100000)\n"
+        "  --dump <file>     Also pack this rect list, e.g. real sprite sizes; repeatable\n"
+        "  --json <file>     Write the results as JSON, \"-\" for stdout\n");
+}
+
+// Uniform, as in the rect-packing demo by default
+static std::vector<PackRect> random_rects(u32 seed, u32 count, u32 min_size, u32 max_size) {
+    return generate_rects({ Distribution::UNIFORM, count, min_size, max_size, seed });
+}
+
+static void write_json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s != '\0'; ++s) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((u8)*s < 0x20) {
+            fprintf(f, "\\u%04x", (u32)(u8)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+struct CorpusResult {
+    std::string corpus;
+    PackerKind packer;
+    bool rotate;
+    u32 count;
+    f64 time;
+    u32 bins;
+    u32 bound;
+    PackStats stats;
+    i64 peak_bytes;
+    bool valid;
+};
+
+// Every corpus into bin_size bins with every packer, largest first, spread over bins on the pool. Then again with
+// every rect allowed to rotate.
+static bool run_corpus(ThreadPool* pool, u32 count, u32 min_size, u32 max_size, u32 bin_size, u32 seed,
+    Span<const char*> dumps, const char* json) {
+    std::vector<std::pair<std::string, std::vector<PackRect>>> corpora = { };
+    for (u8 d = 0; d < (u8)Distribution::COUNT; ++d) {
+        corpora.push_back({ distribution_name((Distribution)d),
+            generate_rects({ (Distribution)d, count, min_size, max_size, seed }) });
+    }
+    for (const char* path : dumps) {
+        std::vector<PackRect> rects = std::vector<PackRect>();
+        if (!read_rects(path, &rects)) {
+            fprintf(stderr, "Failed to read %s\n", path);
+            return false;
+        }
+        corpora.push_back({ path, std::move(rects) });
+    }
+
+    FILE* table = json != nullptr && strcmp(json, "-") == 0 ? stderr : stdout;
+    fprintf(table, "%-12s %-18s %-6s %8s %12s %8s %8s %10s %10s\n", "corpus", "packer", "rotate", "count", "time",
+        "bins", "bound", "occupancy", "peak heap");
+    std::vector<CorpusResult> results = std::vector<CorpusResult>();
+    const u64 bin_area = (u64)bin_size * bin_size;
+    for (const auto& corpus : corpora) {
+        u64 area = 0;
+        for (const PackRect& r : corpus.second) {
+            area += (u64)r.w * r.h;
+        }
+
+        for (u32 i = 0; i < 2 * (u32)PackerKind::COUNT; ++i) {
+            CorpusResult result = CorpusResult();
+            result.corpus = corpus.first;
+            result.packer = (PackerKind)(i / 2);
+            result.rotate = i % 2 != 0;
+            result.count = (u32)corpus.second.size();
+            result.bound = (u32)((area + bin_area - 1) / bin_area);
+
+            std::vector<PackRect> rects = corpus.second;
+            for (PackRect& r : rects) {
+                r.may_rotate = r.may_rotate || result.rotate;
+            }
+            const i64 heap_before = heap_live.load();
+            heap_peak.store(heap_before);
+            const f64 start = seconds();
+            result.bins = pack_bins(pool, bin_size, bin_size, rects,
+                { result.packer, SortOrder::AREA_DESC, BinStrategy::DISTRIBUTE });
+            result.time = seconds() - start;
+            result.peak_bytes = heap_peak.load() - heap_before;
+
+            result.stats = pack_stats(bin_size, bin_size, rects);
+            result.valid = check_packing(bin_size, bin_size, rects).ok() && result.stats.packed == result.count;
+            fprintf(table, "%-12s %-18s %-6s %8u %9.3f ms %8u %8u %9.2f%% %7.1f MB%s\n", result.corpus.c_str(),
+                packer_name(result.packer), result.rotate ? "yes" : "no", result.count, result.time * 1e3, result.bins, result.bound,
+                result.stats.occupancy * 100.0, result.peak_bytes / 1048576.0, result.valid ? "" : "   INVALID");
+            results.push_back(result);
+        }
+    }
+
+    bool valid = true;
+    for (const CorpusResult& result : results) {
+        valid = valid && result.valid;
+    }
+    if (json == nullptr) {
+        return valid;
+    }
+
+    FILE* f = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+    if (f == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", json);
+        return false;
+    }
+    fprintf(f, "{\n  \"corpus_version\": %u,\n  \"seed\": %u,\n  \"min_size\": %u,\n  \"max_size\": %u,\n"
+        "  \"bin_size\": %u,\n  \"threads\": %u,\n  \"results\": [", CORPUS_VERSION, seed, min_size, max_size,
+        bin_size, (u32)pool->size());
+    for (usize i = 0; i < results.size(); ++i) {
+        const CorpusResult& result = results[i];
+        fprintf(f, "%s\n    { \"corpus\": ", i == 0 ? "" : ",");
+        write_json_string(f, result.corpus.c_str());
+        fprintf(f, ", \"packer\": \"%s\", \"order\": \"%s\", \"rotate\": %s, \"count\": %u, \"time_ms\": %.3f, "
+            "\"bins\": %u, \"bound\": %u, \"occupancy\": %.6f, \"peak_heap_bytes\": %lld, \"valid\": %s }",
+            packer_name(result.packer), sort_order_name(SortOrder::AREA_DESC), result.rotate ? "true" : "false",
+            result.count, result.time * 1e3, result.bins, result.bound, result.stats.occupancy,
+            (long long)result.peak_bytes, result.valid ? "true" : "false");
+    }
+    fprintf(f, "\n  ]\n}\n");
+    bool ok = !ferror(f);
+    if (f != stdout) {
+        ok = fclose(f) == 0 && ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s\n", json);
+    }
+    return valid && ok;
+}
+
+int main(int argc, const char* argv[]) {
+    u32 max_count = 100000;
+    u32 min_size = 25;
+    u32 max_size = 150;
+    u32 bin_size = 2048;
+    u32 seed = 1;
+    bool corpus = false;
+    u32 corpus_count = 100000;
+    std::vector<const char*> dumps = std::vector<const char*>();
+    const char* json = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--max-count") == 0 && i + 1 < argc) {
+            max_count = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--min-size") == 0 && i + 1 < argc) {
+            min_size = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bin-size") == 0 && i + 1 < argc) {
+            bin_size = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (u32)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--corpus") == 0) {
+            corpus = true;
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            corpus_count = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dumps.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    max_size = max(min_size, max_size);
+    bin_size = max(max_size, bin_size);
+
+    ThreadPool pool = ThreadPool();
+    if (corpus) {
+        return run_corpus(&pool, corpus_count, min_size, max_size, bin_size, seed, dumps, json) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    u32 invalid = 0;
+    auto check = [&](u32 bin_w, u32 bin_h, Span<const PackRect> rects) {
+        const PackCheck result = check_packing(bin_w, bin_h, rects);
+        if (!result.ok()) {
+            invalid += 1;
+        }
+        return result.ok() ? "" : "   INVALID";
+    };
+    printf("%-8s %-18s %-10s %12s %10s %10s\n", "count", "packer", "order", "time", "packed", "occupancy");
+    for (u32 count = 100; count <= max_count; count *= 10) {
+        const std::vector<PackRect> input = random_rects(seed, count, min_size, max_size);
+
+        // Square bin with exactly the total area, so occupancy shows how close a packer gets to perfect
+        u64 area = 0;
+        for (const PackRect& r : input) {
+            area += (u64)r.w * r.h;
+        }
+        const u32 side = (u32)std::ceil(std::sqrt((f64)area));
+
+        for (u8 p = 0; p < (u8)PackerKind::COUNT; ++p) {
+            std::unique_ptr<Packer> packer = make_packer((PackerKind)p);
+            for (u8 o = 0; o < (u8)SortOrder::COUNT; ++o) {
+                std::vector<PackRect> rects = std::vector<PackRect>();
+                f64 best = 1e30;
+                for (u32 run = 0; run < 3; ++run) {
+                    rects = input;
+                    const f64 start = seconds();
+                    sort_rects(rects, (SortOrder)o);
+                    packer->pack(side, side, rects);
+                    best = min(best, seconds() - start);
+                }
+
+                const PackStats stats = pack_stats(side, side, rects);
+                printf("%-8u %-18s %-10s %9.3f ms %9.2f%% %9.2f%%%s\n", count, packer_name((PackerKind)p),
+                    sort_order_name((SortOrder)o), best * 1e3, 100.0 * stats.packed / stats.count, stats.occupancy * 100.0,
+                    check(side, side, rects));
+            }
+        }
+
+        // All of the above, and rotated, at once
+        SolveOptions options = SolveOptions();
+        options.rotate = true;
+        const f64 start = seconds();
+        const SolveResult result = solve_pack(&pool, side, side, input, options);
+        const f64 time = seconds() - start;
+        printf("%-8u %-18s %-10s %9.3f ms %9.2f%% %9.2f%%   %s, %s, %u candidates on %u threads%s\n", count, "solve",
+            "best", time * 1e3, 100.0 * result.stats.packed / result.stats.count, result.stats.occupancy * 100.0,
+            packer_name(result.best.packer), orientation_name(result.best.orientation), result.tried, (u32)pool.size(),
+            check(side, side, result.rects));
+    }
+
+    // Pages needed against the lower bound of total area over bin area
+    const PackerKind bin_packers[] = { PackerKind::SKYLINE_BL, PackerKind::MAXRECTS_BSSF, PackerKind::GUILLOTINE };
+    printf("\n%-8s %-18s %-10s %12s %8s %8s %10s\n", "count", "packer", "strategy", "time", "bins", "bound",
+        "occupancy");
+    for (u32 count = 1000; count <= 10 * max_count; count *= 10) {
+        const std::vector<PackRect> input = random_rects(seed, count, min_size, max_size);
+        u64 area = 0;
+        for (const PackRect& r : input) {
+            area += (u64)r.w * r.h;
+        }
+        const u64 bin_area = (u64)bin_size * bin_size;
+        const u32 bound = (u32)((area + bin_area - 1) / bin_area);
+
+        for (PackerKind p : bin_packers) {
+            for (u8 s = 0; s < (u8)BinStrategy::COUNT; ++s) {
+                std::vector<PackRect> rects = input;
+                const BinOptions options = { p, p == PackerKind::SKYLINE_BL ? SortOrder::HEIGHT : SortOrder::AREA_DESC,
+                    (BinStrategy)s };
+                const f64 start = seconds();
+                const u32 bins = pack_bins(&pool, bin_size, bin_size, rects, options);
+                const f64 time = seconds() - start;
+
+                const PackStats stats = pack_stats(bin_size, bin_size, rects);
+                printf("%-8u %-18s %-10s %9.3f ms %8u %8u %9.2f%%%s\n", count, packer_name(p),
+                    bin_strategy_name((BinStrategy)s), time * 1e3, bins, bound, stats.occupancy * 100.0,
+                    check(bin_size, bin_size, rects));
+            }
+        }
+    }
+
+    // Live rects fill about 70% of the atlas, then each round frees a random one and allocates a new one
+    printf("\n%-8s %12s %8s %12s %12s %8s %12s\n", "live", "per op", "failed", "fragmented", "defragment", "moves",
+        "after");
+    for (u32 count = 100; count <= max_count; count *= 10) {
+        RandomXOR rng = RandomXOR();
+        const f64 avg_side = (min_size + max_size) / 2.0;
+        const u32 side = (u32)std::ceil(std::sqrt(count * avg_side * avg_side / 0.7));
+        AtlasAllocator atlas = AtlasAllocator(side, side);
+        std::vector<u32> ids = std::vector<u32>();
+        for (u32 i = 0; i < count; ++i) {
+            const u32 id = atlas.allocate(rng.random<u32>(min_size, max_size), rng.random<u32>(min_size, max_size));
+            if (id != AtlasAllocator::INVALID) {
+                ids.push_back(id);
+            }
+        }
+
+        const u32 rounds = 10 * count;
+        u32 failed = 0;
+        const f64 start = seconds();
+        for (u32 i = 0; i < rounds && !ids.empty(); ++i) {
+            const u32 k = rng.next() % (u32)ids.size();
+            atlas.free(ids[k]);
+            ids[k] = atlas.allocate(rng.random<u32>(min_size, max_size), rng.random<u32>(min_size, max_size));
+            if (ids[k] == AtlasAllocator::INVALID) {
+                failed += 1;
+                ids[k] = ids.back();
+                ids.pop_back();
+            }
+        }
+        const f64 churn = seconds() - start;
+        const AtlasAllocator::Stats before = atlas.stats();
+
+        const f64 defrag_start = seconds();
+        const std::vector<AtlasAllocator::Move> moves = atlas.defragment();
+        const f64 defrag = seconds() - defrag_start;
+        const AtlasAllocator::Stats after = atlas.stats();
+
+        printf("%-8u %9.1f ns %8u %11.1f%% %9.3f ms %8u %11.1f%%\n", before.allocations, churn * 1e9 / (2.0 * rounds),
+            failed, before.fragmentation * 100.0, defrag * 1e3, (u32)moves.size(), after.fragmentation * 100.0);
+    }
+
+    if (invalid > 0) {
+        fprintf(stderr, "%u packings overlapped or left their bin\n", invalid);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
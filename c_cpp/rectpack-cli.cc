@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: MIT
+
+// Headless rectangle packing: reads a rect list, packs it into one bin, or as many as needed, and writes the
+// placements.
+
+#include "hk.hh"
+#include "rectpack.hh"
+
+#include <chrono>
+
+using namespace hk;
+
+static f64 seconds() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: rectpack [options] [input]\n"
+        "\n"
+        "Reads \"<w> <h>\" lines from input (default: stdin) and writes \"<id> <w> <h> <x> <y> <bin>\" lines, with \"-\"\n"
+        "as the position and bin of rects that didn't fit. Inputs ending in \"r\" may be rotated, and rotated results\n"
+        "end in \"r\", with w and h as placed.\n"
+        "\n"
+        "Options:\n"
+        "  -W <n>          Bin width (default: 512)\n"
+        "  -H <n>          Bin height (default: 512)\n"
+        "  -p <packer>     Packing algorithm (default: %s)\n"
+        "  -s <order>      Sort order before packing (default: %s)\n"
+        "  -o <file>       Output file (default: stdout)\n"
+        "  --may-rotate    Let the packer rotate every rect, not just those marked\n"
+        "  --solve         Try every packer and sort order in parallel and keep the best\n"
+        "  --rotate        With --solve, also try the rects that may rotate all turned wide or tall\n"
+        "  --budget <ms>   With --solve, start no candidate after this long (default: no limit)\n"
+        "  --bins          Open as many bins as needed instead of solving for one\n"
+        "  --strategy <s>  With --bins, how rects are spread over bins (default: %s)\n"
+        "  -j <n>          With --solve or --bins, number of threads (default: all cores)\n"
+        "\n"
+        "Generated input, instead of reading it:\n"
+        "  --generate <d>  Rect size distribution\n"
+        "  -n <n>          Number of rects (default: 1000)\n"
+        "  --seed <n>      Seed (default: 1)\n"
+        "  --min-size <n>  Smallest rect side (default: 25)\n"
+        "  --max-size <n>  Largest rect side (default: 150)\n"
+        "\n"
+        "Guillotine options:\n"
+        "  --choice <c>    Free rect choice (default: %s)\n"
+        "  --split <s>     Split rule (default: %s)\n"
+        "  --no-merge      Don't merge free rects\n",
+        packer_name(PackerKind::SHELF), sort_order_name(SortOrder::NONE), bin_strategy_name(BinStrategy::SEQUENTIAL),
+        guillotine_choice_name(DEFAULT_GUILLOTINE_OPTIONS.choice), guillotine_split_name(DEFAULT_GUILLOTINE_OPTIONS.split));
+
+    fprintf(stderr, "\nPackers:");
+    for (u8 i = 0; i < (u8)PackerKind::COUNT; ++i) {
+        fprintf(stderr, " %s", packer_name((PackerKind)i));
+    }
+    fprintf(stderr, "\n(%s looks at every free rect a rect fits in, it's slow past tens of thousands of rects)",
+        packer_name(PackerKind::MAXRECTS_CONTACT));
+    fprintf(stderr, "\nSort orders:");
+    for (u8 i = 0; i < (u8)SortOrder::COUNT; ++i) {
+        fprintf(stderr, " %s", sort_order_name((SortOrder)i));
+    }
+    fprintf(stderr, "\nBin strategies:");
+    for (u8 i = 0; i < (u8)BinStrategy::COUNT; ++i) {
+        fprintf(stderr, " %s", bin_strategy_name((BinStrategy)i));
+    }
+    fprintf(stderr, "\nDistributions:");
+    for (u8 i = 0; i < (u8)Distribution::COUNT; ++i) {
+        fprintf(stderr, " %s", distribution_name((Distribution)i));
+    }
+    fprintf(stderr, "\nGuillotine choices:");
+    for (u8 i = 0; i < (u8)GuillotineChoice::COUNT; ++i) {
+        fprintf(stderr, " %s", guillotine_choice_name((GuillotineChoice)i));
+    }
+    fprintf(stderr, "\nGuillotine splits:");
+    for (u8 i = 0; i < (u8)GuillotineSplit::COUNT; ++i) {
+        fprintf(stderr, " %s", guillotine_split_name((GuillotineSplit)i));
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, const char* argv[]) {
+    u32 bin_w = 512;
+    u32 bin_h = 512;
+    PackerKind kind = PackerKind::SHELF;
+    SortOrder order = SortOrder::NONE;
+    GuillotineOptions guillotine = DEFAULT_GUILLOTINE_OPTIONS;
+    bool solve = false;
+    SolveOptions solve_options = SolveOptions();
+    bool bins = false;
+    BinStrategy strategy = BinStrategy::SEQUENTIAL;
+    usize threads = 0;
+    bool may_rotate = false;
+    bool generate = false;
+    CorpusOptions corpus = { Distribution::UNIFORM, 1000, 25, 150, 1 };
+    const char* input = "-";
+    const char* output = "-";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            bin_w = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            bin_h = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            if (!packer_from_name(argv[++i], &kind)) {
+                fprintf(stderr, "Unknown packer %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (!sort_order_from_name(argv[++i], &order)) {
+                fprintf(stderr, "Unknown sort order %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--choice") == 0 && i + 1 < argc) {
+            if (!guillotine_choice_from_name(argv[++i], &guillotine.choice)) {
+                fprintf(stderr, "Unknown guillotine choice %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc) {
+            if (!guillotine_split_from_name(argv[++i], &guillotine.split)) {
+                fprintf(stderr, "Unknown guillotine split %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--no-merge") == 0) {
+            guillotine.merge = false;
+        } else if (strcmp(argv[i], "--may-rotate") == 0) {
+            may_rotate = true;
+        } else if (strcmp(argv[i], "--solve") == 0) {
+            solve = true;
+        } else if (strcmp(argv[i], "--rotate") == 0) {
+            solve_options.rotate = true;
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            solve_options.time_budget = max(0, atoi(argv[++i])) / 1000.0;
+        } else if (strcmp(argv[i], "--bins") == 0) {
+            bins = true;
+        } else if (strcmp(argv[i], "--strategy") == 0 && i + 1 < argc) {
+            if (!bin_strategy_from_name(argv[++i], &strategy)) {
+                fprintf(stderr, "Unknown bin strategy %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            generate = true;
+            if (!distribution_from_name(argv[++i], &corpus.distribution)) {
+                fprintf(stderr, "Unknown distribution %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            corpus.count = (u32)max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            corpus.seed = (u32)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--min-size") == 0 && i + 1 < argc) {
+            corpus.min_size = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            corpus.max_size = (u32)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (usize)max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            input = argv[i];
+        }
+    }
+
+    std::vector<PackRect> rects = std::vector<PackRect>();
+    char source[128] = "";
+    if (generate) {
+        rects = generate_rects(corpus);
+        snprintf(source, sizeof(source), "%u %s rects in [%u, %u], seed %u, corpus v%u; ", corpus.count,
+            distribution_name(corpus.distribution), corpus.min_size, max(corpus.min_size, corpus.max_size), corpus.seed,
+            CORPUS_VERSION);
+    } else if (!read_rects(input, &rects)) {
+        fprintf(stderr, "Failed to read %s\n", input);
+        return EXIT_FAILURE;
+    }
+    if (may_rotate) {
+        for (PackRect& r : rects) {
+            r.may_rotate = true;
+        }
+    }
+
+    Orientation orientation = Orientation::AS_GIVEN;
+    char solved[64] = "";
+    if (bins) {
+        ThreadPool pool = ThreadPool(threads);
+        const f64 start = seconds();
+        const u32 count = pack_bins(&pool, bin_w, bin_h, rects, { kind, order, strategy });
+        snprintf(solved, sizeof(solved), " (%u bins, %s, %.0f ms)", count, bin_strategy_name(strategy),
+            (seconds() - start) * 1e3);
+    } else if (solve) {
+        ThreadPool pool = ThreadPool(threads);
+        SolveResult result = solve_pack(&pool, bin_w, bin_h, rects, solve_options);
+        rects.swap(result.rects);
+        kind = result.best.packer;
+        order = result.best.order;
+        orientation = result.best.orientation;
+        snprintf(solved, sizeof(solved), " (best of %u/%u)", result.tried, result.candidates);
+    } else {
+        sort_rects(rects, order);
+        std::unique_ptr<Packer> packer = kind == PackerKind::GUILLOTINE ? make_guillotine_packer(guillotine) : make_packer(kind);
+        packer->pack(bin_w, bin_h, rects);
+        sort_rects_by_id(rects);
+    }
+
+    const PackStats stats = pack_stats(bin_w, bin_h, rects);
+    char comment[384];
+    snprintf(comment, sizeof(comment), "%s%ux%u %s, sorted by %s, %s%s: %u of %u packed, %.2f%% occupancy",
+        source, bin_w, bin_h, packer_name(kind), sort_order_name(order), orientation_name(orientation), solved, stats.packed,
+        stats.count, stats.occupancy * 100.0);
+    if (!write_rects(output, rects, comment)) {
+        fprintf(stderr, "Failed to write %s\n", output);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "%s\n", comment);
+
+    const PackCheck check = check_packing(bin_w, bin_h, rects);
+    if (check.out_of_bounds > 0) {
+        fprintf(stderr, "%u rects left the bin\n", check.out_of_bounds);
+    }
+    if (check.overlap_a != UINT32_MAX) {
+        fprintf(stderr, "Rects %u and %u overlap\n", check.overlap_a, check.overlap_b);
+    }
+
+    return stats.packed == stats.count && check.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,2121 @@
+// SPDX-License-Identifier: MIT
+
+#include "rectpack.hh"
+
+#include <algorithm> // std::stable_sort, std::sort, std::push_heap
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+namespace hk {
+
+// ==============================
+// Rectangles
+// ==============================
+
+const char* sort_order_name(SortOrder order) {
+    switch (order) {
+    case SortOrder::NONE:      { return "none"; } break;
+    case SortOrder::AREA:      { return "area"; } break;
+    case SortOrder::AREA_DESC: { return "area-desc"; } break;
+    case SortOrder::HEIGHT:    { return "height"; } break;
+    case SortOrder::COUNT:     { } break;
+    }
+    return "?";
+}
+
+bool sort_order_from_name(const char* name, SortOrder* order) {
+    for (u8 i = 0; i < (u8)SortOrder::COUNT; ++i) {
+        if (str::ieq(name, sort_order_name((SortOrder)i))) {
+            *order = (SortOrder)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static u64 rect_area(const PackRect& r) {
+    return (u64)r.w * r.h;
+}
+
+static u32 bit_width(u64 v) {
+    u32 bits = 0;
+    while (v != 0) {
+        bits += 1;
+        v >>= 1;
+    }
+    return bits;
+}
+
+static u32 bit_count(u32 v) {
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// Index of the lowest set bit, v != 0. De Bruijn multiply, no compiler intrinsics.
+static u32 lowest_bit(u64 v) {
+    static const u8 INDEX[64] = {
+         0,  1,  2, 53,  3,  7, 54, 27,  4, 38, 41,  8, 34, 55, 48, 28,
+        62,  5, 39, 46, 44, 42, 22,  9, 24, 35, 59, 56, 49, 18, 29, 11,
+        63, 52,  6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+        51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12
+    };
+    return INDEX[((v & (0 - v)) * 0x022FDD63CC95386DULL) >> 58];
+}
+
+// Stable by key. Each key is packed above its rect's index into one u64, and those are radix sorted 8 bits at a
+// time over the bytes the keys span, so a pass streams 8 bytes per rect and each rect is moved once at the end,
+// instead of moving whole rects O(n log n) times through a comparison sort. Keys too wide to share a u64 with the
+// index fall back to a comparison sort of the indices.
+static void sort_rects_by_key(Span<PackRect> rects, const std::vector<u64>& keys) {
+    const usize n = rects.size();
+    if (n < 2) {
+        return;
+    }
+
+    u64 max_key = 0;
+    for (u64 key : keys) {
+        max_key = max(max_key, key);
+    }
+    const u32 index_bits = bit_width(n - 1);
+    const u32 key_bits = bit_width(max_key);
+    if (key_bits == 0) {
+        return;
+    }
+
+    std::vector<u64> items = std::vector<u64>(n);
+    if (index_bits + key_bits <= 64) {
+        const u32 first_byte = index_bits / 8;
+        const u32 end_byte = (index_bits + key_bits + 7) / 8;
+        std::vector<u32> counts = std::vector<u32>(256 * (end_byte - first_byte));
+        for (usize i = 0; i < n; ++i) {
+            items[i] = (keys[i] << index_bits) | i;
+            for (u32 b = first_byte; b < end_byte; ++b) {
+                counts[256 * (b - first_byte) + ((items[i] >> (8 * b)) & 0xff)] += 1;
+            }
+        }
+
+        std::vector<u64> tmp = std::vector<u64>(n);
+        for (u32 b = first_byte; b < end_byte; ++b) {
+            u32* offsets = &counts[256 * (b - first_byte)];
+            u32 sum = 0;
+            for (u32 d = 0; d < 256; ++d) {
+                const u32 count = offsets[d];
+                offsets[d] = sum;
+                sum += count;
+            }
+            for (u64 item : items) {
+                tmp[offsets[(item >> (8 * b)) & 0xff]++] = item;
+            }
+            items.swap(tmp);
+        }
+        const u64 index_mask = ((u64)1 << index_bits) - 1;
+        for (u64& item : items) {
+            item &= index_mask;
+        }
+    } else {
+        for (usize i = 0; i < n; ++i) {
+            items[i] = i;
+        }
+        std::stable_sort(items.begin(), items.end(), [&](u64 left, u64 right) {
+            return keys[left] < keys[right];
+        });
+    }
+
+    std::vector<PackRect> sorted = std::vector<PackRect>();
+    sorted.reserve(n);
+    for (u64 index : items) {
+        sorted.push_back(rects[index]);
+    }
+    std::copy(sorted.begin(), sorted.end(), rects.begin());
+}
+
+void sort_rects(Span<PackRect> rects, SortOrder order) {
+    if (order == SortOrder::NONE || order == SortOrder::COUNT) {
+        return;
+    }
+    std::vector<u64> keys = std::vector<u64>(rects.size());
+    u64 max_area = 0;
+    for (usize i = 0; i < rects.size(); ++i) {
+        switch (order) {
+        case SortOrder::AREA:
+        case SortOrder::AREA_DESC: { keys[i] = rect_area(rects[i]); } break;
+        case SortOrder::HEIGHT:    { keys[i] = rects[i].h; } break;
+        case SortOrder::NONE:
+        case SortOrder::COUNT:     { } break;
+        }
+        max_area = max(max_area, keys[i]);
+    }
+    // Largest first, as a small key, so it packs as tightly as the others
+    if (order == SortOrder::AREA_DESC) {
+        for (u64& key : keys) {
+            key = max_area - key;
+        }
+    }
+    sort_rects_by_key(rects, keys);
+}
+
+void sort_rects_by_id(Span<PackRect> rects) {
+    std::vector<u64> keys = std::vector<u64>(rects.size());
+    for (usize i = 0; i < rects.size(); ++i) {
+        keys[i] = rects[i].id;
+    }
+    sort_rects_by_key(rects, keys);
+}
+
+const char* orientation_name(Orientation orientation) {
+    switch (orientation) {
+    case Orientation::AS_GIVEN: { return "as-given"; } break;
+    case Orientation::WIDE:     { return "wide"; } break;
+    case Orientation::TALL:     { return "tall"; } break;
+    case Orientation::COUNT:    { } break;
+    }
+    return "?";
+}
+
+bool orientation_from_name(const char* name, Orientation* orientation) {
+    for (u8 i = 0; i < (u8)Orientation::COUNT; ++i) {
+        if (str::ieq(name, orientation_name((Orientation)i))) {
+            *orientation = (Orientation)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void turn_rect(PackRect* r) {
+    std::swap(r->w, r->h);
+    r->rotated = !r->rotated;
+}
+
+void orient_rects(Span<PackRect> rects, Orientation orientation) {
+    if (orientation == Orientation::AS_GIVEN) {
+        return;
+    }
+    for (PackRect& r : rects) {
+        if (!r.may_rotate) {
+            continue;
+        }
+        if ((orientation == Orientation::WIDE && r.h > r.w) || (orientation == Orientation::TALL && r.w > r.h)) {
+            turn_rect(&r);
+        }
+    }
+}
+
+// ==============================
+// Shelf packer
+// ==============================
+
+// Left to right in rows, a new row above the tallest rect of the current one when the next rect doesn't fit. A rect
+// that may rotate stands up if that fits under the row's height, and otherwise lies down, to keep rows low.
+class ShelfPacker : public Packer {
+public:
+    PackerKind kind() const override {
+        return PackerKind::SHELF;
+    }
+
+    void pack(u32 bin_w, u32 bin_h, Span<PackRect> rects) override {
+        u64 x_cur = 0;
+        u64 y_cur = 0;
+        u64 y_step = 0;
+        for (PackRect& rect : rects) {
+            rect.packed = false;
+            rect.bin = 0;
+            if (rect.may_rotate && rect.w != rect.h) {
+                const u32 narrow = min(rect.w, rect.h);
+                const u32 wide = max(rect.w, rect.h);
+                const bool stand = (wide <= y_step && x_cur + narrow <= bin_w) || wide > bin_w;
+                if (rect.w != (stand ? narrow : wide)) {
+                    turn_rect(&rect);
+                }
+            }
+            if (rect.w > bin_w) {
+                continue;
+            }
+            if (x_cur + rect.w > bin_w) {
+                y_cur += y_step;
+                y_step = 0;
+                x_cur = 0;
+            }
+            if (y_cur + rect.h > bin_h) {
+                continue;
+            }
+            y_step = max<u64>(y_step, rect.h);
+            rect.x = (u32)x_cur;
+            rect.y = (u32)y_cur;
+            rect.packed = true;
+            x_cur += rect.w;
+        }
+    }
+};
+
+// ==============================
+// Skyline packer
+// ==============================
+
+// The packed area is summarized by its top outline, a list of horizontal segments sorted by x that covers the bin
+// width. A rect goes on top of the outline, at the left end of some segment, resting on the highest segment under
+// it. Space below the outline is never reused, which is what keeps this fast.
+//
+// Candidate positions are scanned with two pointers: as the left end moves right, so does the segment under the
+// right end, and a monotonic queue tracks the highest segment between them. So finding a position and updating
+// the outline are both O(outline length).
+class SkylinePacker : public Packer {
+private:
+    struct Segment {
+        u32 x;
+        u32 y;
+        u32 w;
+    };
+
+    struct Fit {
+        usize index;
+        u32 y;
+        u64 score;
+        u64 tiebreak;
+    };
+
+    PackerKind heuristic;
+    std::vector<Segment> skyline;
+    std::vector<u64> prefix_area;
+    // Monotonic queue of segment indices, highest first, live from highest_head on
+    std::vector<usize> highest;
+    usize highest_head;
+public:
+    explicit SkylinePacker(PackerKind heuristic) : heuristic(heuristic), highest_head(0) { }
+
+    PackerKind kind() const override {
+        return heuristic;
+    }
+
+    void pack(u32 bin_w, u32 bin_h, Span<PackRect> rects) override {
+        skyline.clear();
+        skyline.push_back({ 0, 0, bin_w });
+        for (PackRect& rect : rects) {
+            rect.packed = false;
+            rect.bin = 0;
+            Fit fit = Fit();
+            bool found = find(bin_w, bin_h, rect.w, rect.h, &fit);
+            Fit turned = Fit();
+            if (rect.may_rotate && rect.w != rect.h && find(bin_w, bin_h, rect.h, rect.w, &turned) &&
+                (!found || turned.score < fit.score || (turned.score == fit.score && turned.tiebreak < fit.tiebreak))) {
+                turn_rect(&rect);
+                fit = turned;
+                found = true;
+            }
+            if (!found) {
+                continue;
+            }
+            rect.x = skyline[fit.index].x;
+            rect.y = fit.y;
+            rect.packed = true;
+            place(fit.index, rect.x, fit.y + rect.h, rect.w);
+        }
+    }
+private:
+    bool find(u32 bin_w, u32 bin_h, u32 w, u32 h, Fit* best) {
+        if (w == 0 || w > bin_w || h > bin_h) {
+            return false;
+        }
+
+        // Area under the outline up to each segment, for the wasted area of min-waste
+        const bool min_waste = heuristic == PackerKind::SKYLINE_MIN_WASTE;
+        if (min_waste) {
+            prefix_area.resize(skyline.size() + 1);
+            prefix_area[0] = 0;
+            for (usize i = 0; i < skyline.size(); ++i) {
+                prefix_area[i + 1] = prefix_area[i] + (u64)skyline[i].y * skyline[i].w;
+            }
+        }
+
+        bool found = false;
+        highest.clear();
+        highest_head = 0;
+        usize j = 0;
+        for (usize i = 0; i < skyline.size(); ++i) {
+            const u64 end = (u64)skyline[i].x + w;
+            if (end > bin_w) {
+                break;
+            }
+            while (highest_head < highest.size() && highest[highest_head] < i) {
+                ++highest_head;
+            }
+            // Segment j holds the rect's right edge. It never trails i, or segments left of the rect would be
+            // queued after the ones left of i were dropped.
+            j = max(j, i);
+            for (; (u64)skyline[j].x + skyline[j].w < end; ++j) {
+                push_highest(j);
+            }
+            push_highest(j);
+
+            const u32 y = skyline[highest[highest_head]].y;
+            if ((u64)y + h > bin_h) {
+                continue;
+            }
+
+            Fit fit = Fit();
+            fit.index = i;
+            fit.y = y;
+            if (min_waste) {
+                const u64 under = prefix_area[j] - prefix_area[i] + (u64)skyline[j].y * (end - skyline[j].x);
+                fit.score = (u64)y * w - under;
+                fit.tiebreak = (u64)y + h;
+            } else {
+                fit.score = (u64)y + h;
+                fit.tiebreak = skyline[i].x;
+            }
+            if (!found || fit.score < best->score || (fit.score == best->score && fit.tiebreak < best->tiebreak)) {
+                *best = fit;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    void push_highest(usize j) {
+        if (highest.size() > highest_head && highest.back() == j) {
+            return;
+        }
+        while (highest.size() > highest_head && skyline[highest.back()].y <= skyline[j].y) {
+            highest.pop_back();
+        }
+        highest.push_back(j);
+    }
+
+    // New segment [x, x + w) at height y, starting at segment index
+    void place(usize index, u32 x, u32 y, u32 w) {
+        const u32 end = x + w;
+        usize last = index;
+        while (last < skyline.size() && skyline[last].x + skyline[last].w <= end) {
+            ++last;
+        }
+        // last is the first segment sticking out past end, if any: trim its left part
+        if (last < skyline.size() && skyline[last].x < end) {
+            skyline[last].w -= end - skyline[last].x;
+            skyline[last].x = end;
+        }
+        skyline.erase(skyline.begin() + index, skyline.begin() + last);
+        skyline.insert(skyline.begin() + index, { x, y, w });
+
+        // Merge with neighbours at the same height, keeps the outline short
+        if (index + 1 < skyline.size() && skyline[index + 1].y == y) {
+            skyline[index].w += skyline[index + 1].w;
+            skyline.erase(skyline.begin() + index + 1);
+        }
+        if (index > 0 && skyline[index - 1].y == y) {
+            skyline[index - 1].w += skyline[index].w;
+            skyline.erase(skyline.begin() + index);
+        }
+    }
+};
+
+// ==============================
+// Spatial buckets
+// ==============================
+
+// Right and bottom edges are exclusive
+struct PackBox {
+    u32 x;
+    u32 y;
+    u32 r;
+    u32 b;
+};
+
+static bool boxes_overlap(const PackBox& a, const PackBox& b) {
+    return a.x < b.r && b.x < a.r && a.y < b.b && b.y < a.b;
+}
+
+// Overlapping or sharing a stretch of edge
+static bool boxes_touch(const PackBox& a, const PackBox& b) {
+    return a.x <= b.r && b.x <= a.r && a.y <= b.b && b.y <= a.b;
+}
+
+static bool box_contains(const PackBox& outer, const PackBox& inner) {
+    return outer.x <= inner.x && outer.y <= inner.y && inner.r <= outer.r && inner.b <= outer.b;
+}
+
+static bool boxes_equal(const PackBox& a, const PackBox& b) {
+    return a.x == b.x && a.y == b.y && a.r == b.r && a.b == b.b;
+}
+
+// Uniform grid over the bin, each cell listing the ids of the boxes that cover it. A box spanning several cells is
+// listed in all of them, so callers dedupe, and ids are only dropped from a cell when a query says so.
+class BoxGrid {
+private:
+    u32 cell_size;
+    u32 cells_x;
+    u32 cells_y;
+    std::vector<std::vector<u32>> cells;
+public:
+    BoxGrid() : cell_size(1), cells_x(0), cells_y(0) { }
+
+    // Cells about the size of an average rect, so a lookup visits a handful of cells with a few boxes each
+    void init(u32 bin_w, u32 bin_h, Span<PackRect> rects) {
+        u64 area = 0;
+        for (const PackRect& r : rects) {
+            area += (u64)r.w * r.h;
+        }
+        const u64 avg_area = rects.size() > 0 ? area / rects.size() : 1;
+        cell_size = max<u32>(1, (u32)std::sqrt((f64)max<u64>(1, avg_area)));
+        // Keep the grid itself small for tiny rects in huge bins
+        while (((u64)bin_w / cell_size + 1) * ((u64)bin_h / cell_size + 1) > ((u64)1 << 20)) {
+            cell_size *= 2;
+        }
+        cells_x = bin_w / cell_size + 1;
+        cells_y = bin_h / cell_size + 1;
+        cells.assign((usize)cells_x * cells_y, std::vector<u32>());
+    }
+
+    u64 span(const PackBox& box) const {
+        return (u64)((box.r - 1) / cell_size - box.x / cell_size + 1) * ((box.b - 1) / cell_size - box.y / cell_size + 1);
+    }
+
+    void add(u32 id, const PackBox& box) {
+        for (u32 cy = box.y / cell_size; cy <= (box.b - 1) / cell_size; ++cy) {
+            for (u32 cx = box.x / cell_size; cx <= (box.r - 1) / cell_size; ++cx) {
+                cells[(usize)cy * cells_x + cx].push_back(id);
+            }
+        }
+    }
+
+    // fn(id) for every id in the cells that can hold a box touching this one, false drops the id from that cell
+    template <typename Fn>
+    void query(const PackBox& box, Fn&& fn) {
+        const u32 cx0 = (box.x > 0 ? box.x - 1 : 0) / cell_size;
+        const u32 cy0 = (box.y > 0 ? box.y - 1 : 0) / cell_size;
+        const u32 cx1 = min(box.r / cell_size, cells_x - 1);
+        const u32 cy1 = min(box.b / cell_size, cells_y - 1);
+        for (u32 cy = cy0; cy <= cy1; ++cy) {
+            for (u32 cx = cx0; cx <= cx1; ++cx) {
+                std::vector<u32>& cell = cells[(usize)cy * cells_x + cx];
+                usize kept = 0;
+                for (usize i = 0; i < cell.size(); ++i) {
+                    if (fn(cell[i])) {
+                        cell[kept++] = cell[i];
+                    }
+                }
+                cell.resize(kept);
+            }
+        }
+    }
+};
+
+// ==============================
+// MaxRects packer
+// ==============================
+
+// Free space is kept as the list of all maximal free rectangles, which overlap each other. A rect goes in the
+// corner of the free rect that scores best, then every free rect it overlaps is split into the up to four maximal
+// pieces around it, and pieces contained in another free rect are dropped.
+//
+// Pruning stays local: a new piece borders the placed rect along a full side, so any free rect that contains it
+// either overlapped the placed rect (and was split) or touches it. Those are found in a bucket grid, and only they
+// are checked, never the whole list against itself. Free rects narrower or shorter than every rect still to be
+// packed are dropped too; on random inputs that's nearly all of them, the slivers left between packed rects.
+// Contact point finds neighbours in a second grid, of the packed rects.
+//
+// Selection doesn't scan the free list either. Free rects are also bucketed by size class, a quarter octave of
+// width by a quarter octave of height, and a rect only visits the buckets it can fit in, smallest first, skipping
+// those whose smallest possible score is already worse than the best found. The pick is the same as a scan in id
+// order would make.
+//
+// Contact point gets little from that, a free rect's size says nothing about how much of its sides are covered. It
+// visits every free rect the rect fits in, but only runs the grid query for those whose sides, 32nds of which are
+// tracked as covered or not, could touch more than the best so far.
+//
+// http://pds25.egloos.com/pds/201504/21/98/RectangleBinPack.pdf
+class MaxRectsPacker : public Packer {
+private:
+    struct Score {
+        u64 primary;
+        u64 secondary;
+    };
+
+    // Free rects spanning more cells than this skip the grid and are checked on every placement. Few are that
+    // large (the strips along the unpacked part of the bin) and they'd cost a lot to list everywhere.
+    static constexpr u64 MAX_GRID_SPAN = 16;
+
+    // Size classes per side, sizes from 4 up split four per octave. The last class takes everything from 112K up.
+    static constexpr u32 SIZE_CLASSES = 64;
+
+    struct Candidate {
+        Score score;
+        u32 id;
+        bool turned;
+    };
+
+    PackerKind heuristic;
+
+    // Every free rect ever made, by id. Dropped ones stay in the list, marked dead, until the next pack().
+    std::vector<PackBox> boxes;
+    std::vector<u8> alive;
+    std::vector<u32> seen;
+    u32 seen_stamp;
+    std::vector<u32> large;
+    // Free rect ids by size class, width class major. Bit j of by_size_rows[i] is set if bucket (i, j) may be
+    // non-empty. Classes whose every size is below what's left to pack are emptied once, from the bottom up.
+    std::vector<std::vector<u32>> by_size;
+    u64 by_size_rows[SIZE_CLASSES];
+    u32 dropped_w;
+    u32 dropped_h;
+    BoxGrid free_grid;
+
+    std::vector<PackBox> pieces;
+    std::vector<PackBox> touching;
+    // Smallest width and height from each rect to the end of the input
+    std::vector<u32> min_w_after;
+    std::vector<u32> min_h_after;
+
+    // Contact point only. Per free rect id, how much of each side (left, top, right, bottom) packed rects cover, and
+    // which 32nds of it they touch. Both only grow while the free rect lives, as rects are packed against it.
+    struct Sides {
+        u32 covered[4];
+        u32 parts[4];
+    };
+
+    std::vector<PackBox> used;
+    std::vector<u32> used_seen;
+    BoxGrid used_grid;
+    std::vector<Sides> covered;
+public:
+    explicit MaxRectsPacker(PackerKind heuristic) : heuristic(heuristic), seen_stamp(0) { }
+
+    PackerKind kind() const override {
+        return heuristic;
+    }
+
+    void pack(u32 bin_w, u32 bin_h, Span<PackRect> rects) override {
+        boxes.clear();
+        alive.clear();
+        seen.clear();
+        seen_stamp = 0;
+        large.clear();
+        by_size.resize((usize)SIZE_CLASSES * SIZE_CLASSES);
+        for (std::vector<u32>& bucket : by_size) {
+            bucket.clear();
+        }
+        memset(by_size_rows, 0, sizeof(by_size_rows));
+        dropped_w = 0;
+        dropped_h = 0;
+        free_grid.init(bin_w, bin_h, rects);
+        used.clear();
+        used_seen.clear();
+        covered.clear();
+        if (heuristic == PackerKind::MAXRECTS_CONTACT) {
+            used_grid.init(bin_w, bin_h, rects);
+        }
+
+        min_w_after.resize(rects.size() + 1);
+        min_h_after.resize(rects.size() + 1);
+        min_w_after[rects.size()] = UINT32_MAX;
+        min_h_after[rects.size()] = UINT32_MAX;
+        for (usize i = rects.size(); i-- > 0;) {
+            const PackRect& r = rects[i];
+            const bool empty = r.w == 0 || r.h == 0;
+            // Either side of a rect that may rotate can end up across
+            const u32 w = r.may_rotate ? min(r.w, r.h) : r.w;
+            const u32 h = r.may_rotate ? min(r.w, r.h) : r.h;
+            min_w_after[i] = empty ? min_w_after[i + 1] : min(min_w_after[i + 1], w);
+            min_h_after[i] = empty ? min_h_after[i + 1] : min(min_h_after[i + 1], h);
+        }
+
+        if (bin_w > 0 && bin_h > 0) {
+            add_free({ 0, 0, bin_w, bin_h });
+        }
+
+        for (usize n = 0; n < rects.size(); ++n) {
+            PackRect& rect = rects[n];
+            rect.packed = false;
+            rect.bin = 0;
+            if (rect.w == 0 || rect.h == 0) {
+                continue;
+            }
+
+            drop_small(min_w_after[n], min_h_after[n]);
+            Candidate best = { Score(), UINT32_MAX, false };
+            find(bin_w, bin_h, rect.w, rect.h, false, n, &best);
+            if (rect.may_rotate && rect.w != rect.h) {
+                find(bin_w, bin_h, rect.h, rect.w, true, n, &best);
+            }
+            if (best.id == UINT32_MAX) {
+                continue;
+            }
+            if (best.turned) {
+                turn_rect(&rect);
+            }
+
+            rect.x = boxes[best.id].x;
+            rect.y = boxes[best.id].y;
+            rect.packed = true;
+            place({ rect.x, rect.y, rect.x + rect.w, rect.y + rect.h }, n);
+        }
+    }
+private:
+    static u32 size_class(u32 size) {
+        if (size < 4) {
+            return size;
+        }
+        const u32 octave = bit_width(size) - 1;
+        return min(SIZE_CLASSES - 1, 4 * (octave - 1) + ((size >> (octave - 2)) & 3));
+    }
+
+    // Smallest size in the class
+    static u32 size_class_min(u32 size_class) {
+        if (size_class < 4) {
+            return size_class;
+        }
+        return (4 + size_class % 4) << (size_class / 4 - 1);
+    }
+
+    static bool better(const Score& a, const Score& b) {
+        return a.primary < b.primary || (a.primary == b.primary && a.secondary < b.secondary);
+    }
+
+    // Lowest score a w x h rect can get in a free rect of size class (i, j). For contact point that's all of its
+    // perimeter touching, less the right side unless the class may be exactly w wide, and the bottom likewise: a free
+    // rect is empty, so a rect placed in its corner only touches something on a side it shares with the free rect.
+    Score lowest_score(u32 i, u32 j, u32 w, u32 h) {
+        if (heuristic == PackerKind::MAXRECTS_CONTACT) {
+            return { (size_class_min(i) <= w ? 0 : h) + (size_class_min(j) <= h ? 0 : (u64)w), 0 };
+        }
+        return score_fit({ 0, 0, max(size_class_min(i), w), max(size_class_min(j), h) }, w, h, 0, 0);
+    }
+
+    // Lowest score a w x h rect can get in free rect id. Only contact point is worth bounding before scoring, its
+    // score costs a grid query, and the sides the rect shares with the free rect can't touch more than they do.
+    Score lowest_score(u32 id, u32 w, u32 h, u32 bin_w, u32 bin_h) {
+        if (heuristic != PackerKind::MAXRECTS_CONTACT) {
+            return Score();
+        }
+        const PackBox& f = boxes[id];
+        const Sides& s = covered[id];
+        u64 length = (f.x == 0 ? h : side_bound(s, 0, f.b - f.y, h)) + (f.y == 0 ? w : side_bound(s, 1, f.r - f.x, w));
+        if (f.r - f.x == w) { length += f.r == bin_w ? h : side_bound(s, 2, f.b - f.y, h); }
+        if (f.b - f.y == h) { length += f.b == bin_h ? w : side_bound(s, 3, f.r - f.x, w); }
+        return { 2 * ((u64)w + h) - length, ((u64)f.y << 32) | f.x };
+    }
+
+    // Updates best with the best place for a w x h rect, the n-th of the input. Ties go to the lower free rect id,
+    // then to not turned, as in a scan of the free list in id order. Lowest scores only grow with the size class, so
+    // the scan of a column, and of the columns, ends at the first class that can't beat the best.
+    void find(u32 bin_w, u32 bin_h, u32 w, u32 h, bool turned, usize n, Candidate* best) {
+        const u32 wi = size_class(w);
+        const u32 hj = size_class(h);
+        for (u32 i = wi; i < SIZE_CLASSES; ++i) {
+            if (best->id != UINT32_MAX && better(best->score, lowest_score(i, hj, w, h))) {
+                break;
+            }
+            u64 rows = by_size_rows[i] >> hj << hj;
+            while (rows != 0) {
+                const u32 j = lowest_bit(rows);
+                const u64 bit = (u64)1 << j;
+                rows -= bit;
+                if (best->id != UINT32_MAX && better(best->score, lowest_score(i, j, w, h))) {
+                    break;
+                }
+
+                std::vector<u32>& bucket = by_size[(usize)i * SIZE_CLASSES + j];
+                usize kept = 0;
+                for (usize k = 0; k < bucket.size(); ++k) {
+                    const u32 id = bucket[k];
+                    const PackBox f = boxes[id];
+                    if (!alive[id]) {
+                        continue;
+                    }
+                    if (f.r - f.x < min_w_after[n] || f.b - f.y < min_h_after[n]) {
+                        alive[id] = false;
+                        continue;
+                    }
+                    bucket[kept++] = id;
+                    if (f.r - f.x < w || f.b - f.y < h) {
+                        continue;
+                    }
+                    if (best->id != UINT32_MAX && better(best->score, lowest_score(id, w, h, bin_w, bin_h))) {
+                        continue;
+                    }
+                    const Score score = score_fit(f, w, h, bin_w, bin_h);
+                    if (best->id == UINT32_MAX || better(score, best->score) ||
+                        (!better(best->score, score) && (id < best->id || (id == best->id && !turned)))) {
+                        *best = { score, id, turned };
+                    }
+                }
+                bucket.resize(kept);
+                if (kept == 0) {
+                    by_size_rows[i] &= ~bit;
+                }
+            }
+        }
+    }
+
+    // Drops the free rects of every size class too narrow or too short for all that's left to pack
+    void drop_small(u32 min_w, u32 min_h) {
+        auto drop = [&](u32 i, u32 j) {
+            for (u32 id : by_size[(usize)i * SIZE_CLASSES + j]) {
+                alive[id] = false;
+            }
+            by_size[(usize)i * SIZE_CLASSES + j].clear();
+            by_size_rows[i] &= ~((u64)1 << j);
+        };
+        while (dropped_w + 1 < SIZE_CLASSES && size_class_min(dropped_w + 1) <= min_w) {
+            for (u32 j = 0; j < SIZE_CLASSES; ++j) {
+                drop(dropped_w, j);
+            }
+            dropped_w += 1;
+        }
+        while (dropped_h + 1 < SIZE_CLASSES && size_class_min(dropped_h + 1) <= min_h) {
+            for (u32 i = 0; i < SIZE_CLASSES; ++i) {
+                drop(i, dropped_h);
+            }
+            dropped_h += 1;
+        }
+    }
+
+    Score score_fit(const PackBox& f, u32 w, u32 h, u32 bin_w, u32 bin_h) {
+        const u64 left_w = (f.r - f.x) - w;
+        const u64 left_h = (f.b - f.y) - h;
+        Score score = Score();
+        switch (heuristic) {
+        case PackerKind::MAXRECTS_BSSF: {
+            score.primary = min(left_w, left_h);
+            score.secondary = max(left_w, left_h);
+        } break;
+        case PackerKind::MAXRECTS_BLSF: {
+            score.primary = max(left_w, left_h);
+            score.secondary = min(left_w, left_h);
+        } break;
+        case PackerKind::MAXRECTS_BAF: {
+            score.primary = (u64)(f.r - f.x) * (f.b - f.y) - (u64)w * h;
+            score.secondary = min(left_w, left_h);
+        } break;
+        case PackerKind::MAXRECTS_CONTACT: {
+            // Most contact first, then lowest, then leftmost
+            score.primary = 2 * ((u64)w + h) - contact({ f.x, f.y, f.x + w, f.y + h }, bin_w, bin_h);
+            score.secondary = ((u64)f.y << 32) | f.x;
+        } break;
+        default: { } break;
+        }
+        return score;
+    }
+
+    void add_free(const PackBox& box) {
+        const u32 id = (u32)boxes.size();
+        boxes.push_back(box);
+        alive.push_back(true);
+        seen.push_back(0);
+        const u32 i = size_class(box.r - box.x);
+        const u32 j = size_class(box.b - box.y);
+        by_size[(usize)i * SIZE_CLASSES + j].push_back(id);
+        by_size_rows[i] |= (u64)1 << j;
+        if (heuristic == PackerKind::MAXRECTS_CONTACT) {
+            covered.push_back(sides_covered(box));
+        }
+        if (free_grid.span(box) > MAX_GRID_SPAN) {
+            large.push_back(id);
+        } else {
+            free_grid.add(id, box);
+        }
+    }
+
+    // Splits the free rects that p overlaps. p is the n-th rect of the input.
+    void place(const PackBox& p, usize n) {
+        pieces.clear();
+        touching.clear();
+        ++seen_stamp;
+        auto visit = [&](u32 id) {
+            if (!alive[id]) {
+                return false;
+            }
+            if (seen[id] == seen_stamp) {
+                return true;
+            }
+            seen[id] = seen_stamp;
+            const PackBox f = boxes[id];
+            if (boxes_overlap(f, p)) {
+                if (p.x > f.x) { pieces.push_back({ f.x, f.y, p.x, f.b }); }
+                if (p.r < f.r) { pieces.push_back({ p.r, f.y, f.r, f.b }); }
+                if (p.y > f.y) { pieces.push_back({ f.x, f.y, f.r, p.y }); }
+                if (p.b < f.b) { pieces.push_back({ f.x, p.b, f.r, f.b }); }
+                alive[id] = false;
+                return false;
+            }
+            if (boxes_touch(f, p)) {
+                touching.push_back(f);
+                if (heuristic == PackerKind::MAXRECTS_CONTACT) {
+                    cover(&covered[id], f, p);
+                }
+            }
+            return true;
+        };
+        free_grid.query(p, visit);
+        usize kept = 0;
+        for (usize i = 0; i < large.size(); ++i) {
+            if (visit(large[i])) {
+                large[kept++] = large[i];
+            }
+        }
+        large.resize(kept);
+
+        if (heuristic == PackerKind::MAXRECTS_CONTACT) {
+            used_grid.add((u32)used.size(), p);
+            used.push_back(p);
+            used_seen.push_back(0);
+        }
+
+        // Old free rects are already maximal, so only new pieces can be redundant. Of identical pieces the first
+        // one stays.
+        for (usize i = 0; i < pieces.size(); ++i) {
+            const PackBox& piece = pieces[i];
+            if (piece.r - piece.x < min_w_after[n + 1] || piece.b - piece.y < min_h_after[n + 1]) {
+                continue;
+            }
+            bool redundant = false;
+            for (usize j = 0; j < touching.size() && !redundant; ++j) {
+                redundant = box_contains(touching[j], piece);
+            }
+            for (usize j = 0; j < pieces.size() && !redundant; ++j) {
+                redundant = j != i && box_contains(pieces[j], piece) && (j < i || !boxes_equal(pieces[j], piece));
+            }
+            if (!redundant) {
+                add_free(piece);
+            }
+        }
+    }
+
+    static u64 shared_length(u32 a0, u32 a1, u32 b0, u32 b1) {
+        return a1 > b0 && b1 > a0 ? min(a1, b1) - max(a0, b0) : 0;
+    }
+
+    static u32 side_part(u32 side_length) {
+        return (side_length + 31) / 32;
+    }
+
+    // Most of the first span of a side, side_length long, that can be covered
+    static u32 side_bound(const Sides& sides, u32 side, u32 side_length, u32 span) {
+        const u32 part = side_part(side_length);
+        const u32 parts = sides.parts[side] & (u32)(((u64)2 << ((span - 1) / part)) - 1);
+        return min(min(span, sides.covered[side]), bit_count(parts) * part);
+    }
+
+    // Adds [u0, u1) of a packed rect to the side spanning [f0, f1)
+    static void cover_side(Sides* sides, u32 side, u32 u0, u32 u1, u32 f0, u32 f1) {
+        if (u1 <= f0 || f1 <= u0) {
+            return;
+        }
+        const u32 part = side_part(f1 - f0);
+        const u32 first = (max(u0, f0) - f0) / part;
+        const u32 last = (min(u1, f1) - f0 - 1) / part;
+        sides->covered[side] += min(u1, f1) - max(u0, f0);
+        sides->parts[side] |= (u32)(((u64)2 << last) - ((u64)1 << first));
+    }
+
+    // Adds what packed rect u covers of f's sides
+    static void cover(Sides* sides, const PackBox& f, const PackBox& u) {
+        if (u.r == f.x) { cover_side(sides, 0, u.y, u.b, f.y, f.b); }
+        if (u.b == f.y) { cover_side(sides, 1, u.x, u.r, f.x, f.r); }
+        if (u.x == f.r) { cover_side(sides, 2, u.y, u.b, f.y, f.b); }
+        if (u.y == f.b) { cover_side(sides, 3, u.x, u.r, f.x, f.r); }
+    }
+
+    // How much of each side of f the packed rects cover. Only the cells along the sides are looked at, free rects
+    // can be most of the bin.
+    Sides sides_covered(const PackBox& f) {
+        Sides sides = Sides();
+        ++seen_stamp;
+        auto visit = [&](u32 id) {
+            if (used_seen[id] != seen_stamp) {
+                used_seen[id] = seen_stamp;
+                cover(&sides, f, used[id]);
+            }
+            return true;
+        };
+        used_grid.query({ f.x, f.y, f.x, f.b }, visit);
+        used_grid.query({ f.r, f.y, f.r, f.b }, visit);
+        used_grid.query({ f.x, f.y, f.r, f.y }, visit);
+        used_grid.query({ f.x, f.b, f.r, f.b }, visit);
+        return sides;
+    }
+
+    // Length of the candidate's perimeter against the bin edges or packed rects
+    u64 contact(const PackBox& c, u32 bin_w, u32 bin_h) {
+        u64 length = 0;
+        if (c.x == 0 || c.r == bin_w) { length += (u64)(c.b - c.y) * ((c.x == 0) + (c.r == bin_w)); }
+        if (c.y == 0 || c.b == bin_h) { length += (u64)(c.r - c.x) * ((c.y == 0) + (c.b == bin_h)); }
+
+        ++seen_stamp;
+        used_grid.query(c, [&](u32 id) {
+            if (used_seen[id] == seen_stamp) {
+                return true;
+            }
+            used_seen[id] = seen_stamp;
+            const PackBox& u = used[id];
+            if (u.r == c.x || u.x == c.r) {
+                length += shared_length(u.y, u.b, c.y, c.b);
+            }
+            if (u.b == c.y || u.y == c.b) {
+                length += shared_length(u.x, u.r, c.x, c.r);
+            }
+            return true;
+        });
+        return length;
+    }
+};
+
+// ==============================
+// Guillotine packer
+// ==============================
+
+const char* guillotine_choice_name(GuillotineChoice choice) {
+    switch (choice) {
+    case GuillotineChoice::BEST_AREA:       { return "best-area"; } break;
+    case GuillotineChoice::BEST_SHORT_SIDE: { return "best-short-side"; } break;
+    case GuillotineChoice::BEST_LONG_SIDE:  { return "best-long-side"; } break;
+    case GuillotineChoice::WORST_AREA:      { return "worst-area"; } break;
+    case GuillotineChoice::COUNT:           { } break;
+    }
+    return "?";
+}
+
+bool guillotine_choice_from_name(const char* name, GuillotineChoice* choice) {
+    for (u8 i = 0; i < (u8)GuillotineChoice::COUNT; ++i) {
+        if (str::ieq(name, guillotine_choice_name((GuillotineChoice)i))) {
+            *choice = (GuillotineChoice)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* guillotine_split_name(GuillotineSplit split) {
+    switch (split) {
+    case GuillotineSplit::SHORTER_LEFTOVER: { return "shorter-leftover"; } break;
+    case GuillotineSplit::LONGER_LEFTOVER:  { return "longer-leftover"; } break;
+    case GuillotineSplit::MIN_AREA:         { return "min-area"; } break;
+    case GuillotineSplit::MAX_AREA:         { return "max-area"; } break;
+    case GuillotineSplit::SHORTER_AXIS:     { return "shorter-axis"; } break;
+    case GuillotineSplit::LONGER_AXIS:      { return "longer-axis"; } break;
+    case GuillotineSplit::COUNT:            { } break;
+    }
+    return "?";
+}
+
+bool guillotine_split_from_name(const char* name, GuillotineSplit* split) {
+    for (u8 i = 0; i < (u8)GuillotineSplit::COUNT; ++i) {
+        if (str::ieq(name, guillotine_split_name((GuillotineSplit)i))) {
+            *split = (GuillotineSplit)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Free rects ordered by one side (then id), each subtree knowing the longest other side in it. That finds the
+// next free rect a size fits in, in either direction, without walking past the ones it doesn't. A treap, so no
+// rebalancing to get wrong; nodes live in a vector and are reused.
+class SideTree {
+private:
+    static constexpr u32 NIL = UINT32_MAX;
+
+    struct Node {
+        u64 key;
+        u32 other;
+        u32 max_other;
+        u32 priority;
+        u32 left;
+        u32 right;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<u32> free_nodes;
+    u32 root;
+    RandomXOR rng;
+public:
+    SideTree() : root(NIL) { }
+
+    static u64 make_key(u32 side, u32 id) {
+        return ((u64)side << 32) | id;
+    }
+
+    static u32 key_side(u64 key) {
+        return (u32)(key >> 32);
+    }
+
+    static u32 key_id(u64 key) {
+        return (u32)key;
+    }
+
+    void clear() {
+        nodes.clear();
+        free_nodes.clear();
+        root = NIL;
+    }
+
+    u32 max_other() const {
+        return root != NIL ? nodes[root].max_other : 0;
+    }
+
+    void insert(u32 side, u32 id, u32 other) {
+        u32 n = NIL;
+        if (!free_nodes.empty()) {
+            n = free_nodes.back();
+            free_nodes.pop_back();
+        } else {
+            n = (u32)nodes.size();
+            nodes.push_back(Node());
+        }
+        nodes[n] = { make_key(side, id), other, other, rng.next(), NIL, NIL };
+
+        u32 left = NIL;
+        u32 right = NIL;
+        split(root, nodes[n].key, &left, &right);
+        root = join(join(left, n), right);
+    }
+
+    void erase(u32 side, u32 id) {
+        const u64 key = make_key(side, id);
+        u32 left = NIL;
+        u32 mid = NIL;
+        u32 right = NIL;
+        split(root, key, &left, &right);
+        split(right, key + 1, &mid, &right);
+        if (mid != NIL) {
+            free_nodes.push_back(mid);
+        }
+        root = join(left, right);
+    }
+
+    // Smallest key >= from whose other side is at least min_other, UINT64_MAX if none
+    u64 next(u64 from, u32 min_other) const {
+        const u32 n = find_next(root, from, min_other);
+        return n != NIL ? nodes[n].key : UINT64_MAX;
+    }
+
+    // Largest key <= to whose other side is at least min_other, UINT64_MAX if none
+    u64 prev(u64 to, u32 min_other) const {
+        const u32 n = find_prev(root, to, min_other);
+        return n != NIL ? nodes[n].key : UINT64_MAX;
+    }
+private:
+    void update(u32 n) {
+        Node& node = nodes[n];
+        node.max_other = node.other;
+        if (node.left != NIL) { node.max_other = max(node.max_other, nodes[node.left].max_other); }
+        if (node.right != NIL) { node.max_other = max(node.max_other, nodes[node.right].max_other); }
+    }
+
+    // Keys < key go left, the rest right
+    void split(u32 n, u64 key, u32* left, u32* right) {
+        if (n == NIL) {
+            *left = NIL;
+            *right = NIL;
+            return;
+        }
+        if (nodes[n].key < key) {
+            split(nodes[n].right, key, &nodes[n].right, right);
+            *left = n;
+        } else {
+            split(nodes[n].left, key, left, &nodes[n].left);
+            *right = n;
+        }
+        update(n);
+    }
+
+    // Every key in left is below every key in right
+    u32 join(u32 left, u32 right) {
+        if (left == NIL) { return right; }
+        if (right == NIL) { return left; }
+        if (nodes[left].priority > nodes[right].priority) {
+            nodes[left].right = join(nodes[left].right, right);
+            update(left);
+            return left;
+        }
+        nodes[right].left = join(left, nodes[right].left);
+        update(right);
+        return right;
+    }
+
+    u32 find_next(u32 n, u64 from, u32 min_other) const {
+        if (n == NIL || nodes[n].max_other < min_other) {
+            return NIL;
+        }
+        const Node& node = nodes[n];
+        if (node.key < from) {
+            return find_next(node.right, from, min_other);
+        }
+        const u32 found = find_next(node.left, from, min_other);
+        if (found != NIL) {
+            return found;
+        }
+        return node.other >= min_other ? n : find_next(node.right, from, min_other);
+    }
+
+    u32 find_prev(u32 n, u64 to, u32 min_other) const {
+        if (n == NIL || nodes[n].max_other < min_other) {
+            return NIL;
+        }
+        const Node& node = nodes[n];
+        if (node.key > to) {
+            return find_prev(node.left, to, min_other);
+        }
+        const u32 found = find_prev(node.right, to, min_other);
+        if (found != NIL) {
+            return found;
+        }
+        return node.other >= min_other ? n : find_prev(node.left, to, min_other);
+    }
+};
+
+// Free rects never overlap here, so each one is indexed by width and by height for choosing (O(log n)), and by
+// its four edges for merging (hashed): two free rects can be merged exactly when one's edge is the other's
+// opposite edge.
+//
+// Best short side fit is exact from two lookups: the narrowest free rect the rect fits in and the shortest one.
+// The other choices visit fitting free rects by width, narrowest (or widest) first, and stop once the width alone
+// rules out beating the best score so far.
+class GuillotineSpace {
+private:
+    // Position of the edge, then its extent
+    struct EdgeKey {
+        u32 at;
+        u32 lo;
+        u32 hi;
+
+        bool operator==(const EdgeKey& other) const {
+            return at == other.at && lo == other.lo && hi == other.hi;
+        }
+    };
+
+    struct EdgeHash {
+        usize operator()(const EdgeKey& key) const {
+            u64 h = ((u64)key.at << 32 | key.lo) * 0x9E3779B97F4A7C15ull;
+            h ^= (h >> 29) ^ ((u64)key.hi * 0xBF58476D1CE4E5B9ull);
+            return (usize)(h ^ (h >> 32));
+        }
+    };
+
+    GuillotineOptions options;
+
+    // Free rects by id. Ids of removed ones are reused.
+    std::vector<PackBox> boxes;
+    std::vector<u8> alive;
+    std::vector<u32> free_ids;
+    u64 free_area;
+    SideTree by_w;
+    SideTree by_h;
+    std::unordered_map<EdgeKey, u32, EdgeHash> by_left;
+    std::unordered_map<EdgeKey, u32, EdgeHash> by_right;
+    std::unordered_map<EdgeKey, u32, EdgeHash> by_top;
+    std::unordered_map<EdgeKey, u32, EdgeHash> by_bottom;
+public:
+    explicit GuillotineSpace(const GuillotineOptions& options) : options(options), free_area(0) { }
+
+    // All free again
+    void reset(u32 bin_w, u32 bin_h) {
+        boxes.clear();
+        alive.clear();
+        free_ids.clear();
+        free_area = 0;
+        by_w.clear();
+        by_h.clear();
+        by_left.clear();
+        by_right.clear();
+        by_top.clear();
+        by_bottom.clear();
+        if (bin_w > 0 && bin_h > 0) {
+            add_free({ 0, 0, bin_w, bin_h });
+        }
+    }
+
+    // Takes w x h out of a free rect, false if there's none it fits in. With may_rotate, h x w too if that fits
+    // better, which sets turned.
+    bool allocate(u32 w, u32 h, bool may_rotate, u32* x, u32* y, bool* turned) {
+        *turned = false;
+        if (w == 0 || h == 0) {
+            return false;
+        }
+        u64 score = 0;
+        u32 id = choose(w, h, &score);
+        u64 turned_score = 0;
+        const u32 turned_id = may_rotate && w != h ? choose(h, w, &turned_score) : UINT32_MAX;
+        if (turned_id != UINT32_MAX && (id == UINT32_MAX || turned_score < score)) {
+            id = turned_id;
+            std::swap(w, h);
+            *turned = true;
+        }
+        if (id == UINT32_MAX) {
+            return false;
+        }
+
+        const PackBox f = boxes[id];
+        remove_free(id);
+        *x = f.x;
+        *y = f.y;
+
+        // One cut across the whole free rect, the other only across the part the packed rect is in
+        const u32 r = f.x + w;
+        const u32 b = f.y + h;
+        if (split_horizontally(f, w, h)) {
+            add_piece({ r, f.y, f.r, b });
+            add_piece({ f.x, b, f.r, f.b });
+        } else {
+            add_piece({ f.x, b, r, f.b });
+            add_piece({ r, f.y, f.r, f.b });
+        }
+        return true;
+    }
+
+    // Gives back what allocate() took, merged with free neighbours where they share a whole edge
+    void release(const PackBox& box) {
+        add_piece(box);
+    }
+
+    u64 get_free_area() const {
+        return free_area;
+    }
+
+    usize free_count() const {
+        return boxes.size() - free_ids.size();
+    }
+
+    template <typename Fn>
+    void for_each_free(Fn&& fn) const {
+        for (usize i = 0; i < boxes.size(); ++i) {
+            if (alive[i]) {
+                fn(boxes[i]);
+            }
+        }
+    }
+private:
+    // Lower scores fit better
+    u32 choose(u32 w, u32 h, u64* fit_score) const {
+        if (options.choice == GuillotineChoice::BEST_SHORT_SIDE) {
+            const u64 narrowest = by_w.next(SideTree::make_key(w, 0), h);
+            const u64 shortest = by_h.next(SideTree::make_key(h, 0), w);
+            if (narrowest == UINT64_MAX || shortest == UINT64_MAX) {
+                return UINT32_MAX;
+            }
+            const u64 left_w = SideTree::key_side(narrowest) - w;
+            const u64 left_h = SideTree::key_side(shortest) - h;
+            *fit_score = min(left_w, left_h);
+            return left_w <= left_h ? SideTree::key_id(narrowest) : SideTree::key_id(shortest);
+        }
+
+        const u64 max_h = by_w.max_other();
+        u32 best = UINT32_MAX;
+        u64 best_score = UINT64_MAX;
+        if (options.choice == GuillotineChoice::WORST_AREA) {
+            // Scored as the negated area. Area is at most width times the tallest free rect.
+            for (u64 key = by_w.prev(UINT64_MAX, h); key != UINT64_MAX && SideTree::key_side(key) >= w;
+                key = key > 0 ? by_w.prev(key - 1, h) : UINT64_MAX) {
+                const u64 fw = SideTree::key_side(key);
+                if (best != UINT32_MAX && UINT64_MAX - fw * max_h >= best_score) {
+                    break;
+                }
+                const PackBox& f = boxes[SideTree::key_id(key)];
+                const u64 score = UINT64_MAX - fw * (f.b - f.y);
+                if (score < best_score) {
+                    best = SideTree::key_id(key);
+                    best_score = score;
+                }
+            }
+            *fit_score = best_score;
+            return best;
+        }
+
+        for (u64 key = by_w.next(SideTree::make_key(w, 0), h); key != UINT64_MAX; key = by_w.next(key + 1, h)) {
+            const u64 fw = SideTree::key_side(key);
+            // Lower bounds of the score from the width alone
+            const u64 bound = options.choice == GuillotineChoice::BEST_AREA ? fw * h : fw - w;
+            if (bound >= best_score) {
+                break;
+            }
+            const PackBox& f = boxes[SideTree::key_id(key)];
+            const u64 fh = f.b - f.y;
+            const u64 score = options.choice == GuillotineChoice::BEST_AREA ? fw * fh : max(fw - w, fh - h);
+            if (score < best_score) {
+                best = SideTree::key_id(key);
+                best_score = score;
+            }
+        }
+        *fit_score = best_score;
+        return best;
+    }
+
+    // Horizontal: the full cut is the horizontal one at y + h
+    bool split_horizontally(const PackBox& f, u32 w, u32 h) const {
+        const u64 free_w = f.r - f.x;
+        const u64 free_h = f.b - f.y;
+        const u64 left_w = free_w - w;
+        const u64 left_h = free_h - h;
+        switch (options.split) {
+        case GuillotineSplit::SHORTER_LEFTOVER: { return left_w <= left_h; } break;
+        case GuillotineSplit::LONGER_LEFTOVER:  { return left_w > left_h; } break;
+        case GuillotineSplit::MIN_AREA:         { return w * left_h > left_w * h; } break;
+        case GuillotineSplit::MAX_AREA:         { return w * left_h <= left_w * h; } break;
+        case GuillotineSplit::SHORTER_AXIS:     { return free_w <= free_h; } break;
+        case GuillotineSplit::LONGER_AXIS:      { return free_w > free_h; } break;
+        case GuillotineSplit::COUNT:            { } break;
+        }
+        return true;
+    }
+
+    void add_piece(PackBox box) {
+        if (box.x == box.r || box.y == box.b) {
+            return;
+        }
+        while (options.merge) {
+            auto it = by_right.find({ box.x, box.y, box.b });
+            if (it != by_right.end()) {
+                box.x = boxes[it->second].x;
+                remove_free(it->second);
+                continue;
+            }
+            it = by_left.find({ box.r, box.y, box.b });
+            if (it != by_left.end()) {
+                box.r = boxes[it->second].r;
+                remove_free(it->second);
+                continue;
+            }
+            it = by_bottom.find({ box.y, box.x, box.r });
+            if (it != by_bottom.end()) {
+                box.y = boxes[it->second].y;
+                remove_free(it->second);
+                continue;
+            }
+            it = by_top.find({ box.b, box.x, box.r });
+            if (it != by_top.end()) {
+                box.b = boxes[it->second].b;
+                remove_free(it->second);
+                continue;
+            }
+            break;
+        }
+        add_free(box);
+    }
+
+    void add_free(const PackBox& box) {
+        u32 id = 0;
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+            boxes[id] = box;
+            alive[id] = true;
+        } else {
+            id = (u32)boxes.size();
+            boxes.push_back(box);
+            alive.push_back(true);
+        }
+        free_area += (u64)(box.r - box.x) * (box.b - box.y);
+        by_w.insert(box.r - box.x, id, box.b - box.y);
+        by_h.insert(box.b - box.y, id, box.r - box.x);
+        by_left.insert({ { box.x, box.y, box.b }, id });
+        by_right.insert({ { box.r, box.y, box.b }, id });
+        by_top.insert({ { box.y, box.x, box.r }, id });
+        by_bottom.insert({ { box.b, box.x, box.r }, id });
+    }
+
+    void remove_free(u32 id) {
+        const PackBox& box = boxes[id];
+        by_w.erase(box.r - box.x, id);
+        by_h.erase(box.b - box.y, id);
+        by_left.erase({ box.x, box.y, box.b });
+        by_right.erase({ box.r, box.y, box.b });
+        by_top.erase({ box.y, box.x, box.r });
+        by_bottom.erase({ box.b, box.x, box.r });
+        free_area -= (u64)(box.r - box.x) * (box.b - box.y);
+        alive[id] = false;
+        free_ids.push_back(id);
+    }
+};
+
+class GuillotinePacker : public Packer {
+private:
+    GuillotineSpace space;
+public:
+    explicit GuillotinePacker(const GuillotineOptions& options) : space(options) { }
+
+    PackerKind kind() const override {
+        return PackerKind::GUILLOTINE;
+    }
+
+    void pack(u32 bin_w, u32 bin_h, Span<PackRect> rects) override {
+        space.reset(bin_w, bin_h);
+        for (PackRect& rect : rects) {
+            bool turned = false;
+            rect.packed = space.allocate(rect.w, rect.h, rect.may_rotate, &rect.x, &rect.y, &turned);
+            rect.bin = 0;
+            if (turned) {
+                turn_rect(&rect);
+            }
+        }
+    }
+};
+
+std::unique_ptr<Packer> make_guillotine_packer(const GuillotineOptions& options) {
+    return std::unique_ptr<Packer>(new GuillotinePacker(options));
+}
+
+// ==============================
+// Online packing
+// ==============================
+
+AtlasAllocator::AtlasAllocator(u32 bin_w, u32 bin_h, const GuillotineOptions& options)
+    : bin_w(bin_w), bin_h(bin_h), options(options), space(new GuillotineSpace(options)), used_area(0) {
+    space->reset(bin_w, bin_h);
+}
+
+AtlasAllocator::~AtlasAllocator() = default;
+
+void AtlasAllocator::clear() {
+    space->reset(bin_w, bin_h);
+    allocations.clear();
+    live.clear();
+    free_ids.clear();
+    used_area = 0;
+}
+
+u32 AtlasAllocator::allocate(u32 w, u32 h) {
+    Allocation a = Allocation();
+    a.w = w;
+    a.h = h;
+    bool turned = false;
+    if (!space->allocate(w, h, false, &a.x, &a.y, &turned)) {
+        return INVALID;
+    }
+
+    u32 id = 0;
+    if (!free_ids.empty()) {
+        id = free_ids.back();
+        free_ids.pop_back();
+        allocations[id] = a;
+        live[id] = true;
+    } else {
+        id = (u32)allocations.size();
+        allocations.push_back(a);
+        live.push_back(true);
+    }
+    used_area += (u64)w * h;
+    return id;
+}
+
+bool AtlasAllocator::free(u32 id) {
+    if (!is_live(id)) {
+        return false;
+    }
+    const Allocation& a = allocations[id];
+    space->release({ a.x, a.y, a.x + a.w, a.y + a.h });
+    used_area -= (u64)a.w * a.h;
+    live[id] = false;
+    free_ids.push_back(id);
+    if (free_ids.size() == allocations.size()) {
+        // Empty: one free rect again, whatever merging managed
+        space->reset(bin_w, bin_h);
+    }
+    return true;
+}
+
+AtlasAllocator::Stats AtlasAllocator::stats() const {
+    Stats stats = Stats();
+    stats.allocations = (u32)(allocations.size() - free_ids.size());
+    stats.used_area = used_area;
+    stats.free_area = space->get_free_area();
+    stats.free_rects = (u32)space->free_count();
+    space->for_each_free([&](const PackBox& box) {
+        stats.largest_free_area = max(stats.largest_free_area, (u64)(box.r - box.x) * (box.b - box.y));
+    });
+    stats.fragmentation = stats.free_area > 0 ? 1.0 - (f64)stats.largest_free_area / (f64)stats.free_area : 0.0;
+    return stats;
+}
+
+std::vector<AtlasAllocator::Move> AtlasAllocator::defragment() {
+    // Largest first into an empty atlas, which leaves the free space in a few big pieces
+    std::vector<u32> order = std::vector<u32>();
+    for (u32 id = 0; id < (u32)allocations.size(); ++id) {
+        if (live[id]) {
+            order.push_back(id);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](u32 left, u32 right) {
+        const u64 left_area = (u64)allocations[left].w * allocations[left].h;
+        const u64 right_area = (u64)allocations[right].w * allocations[right].h;
+        if (left_area != right_area) {
+            return left_area > right_area;
+        }
+        return left < right;
+    });
+
+    std::unique_ptr<GuillotineSpace> repacked = std::unique_ptr<GuillotineSpace>(new GuillotineSpace(options));
+    repacked->reset(bin_w, bin_h);
+    std::vector<Move> moves = std::vector<Move>();
+    for (u32 id : order) {
+        const Allocation& a = allocations[id];
+        Move move = Move();
+        move.id = id;
+        move.from_x = a.x;
+        move.from_y = a.y;
+        // Packing everything at once can fail where one at a time didn't. Keep the old layout then.
+        bool turned = false;
+        if (!repacked->allocate(a.w, a.h, false, &move.to_x, &move.to_y, &turned)) {
+            return std::vector<Move>();
+        }
+        if (move.to_x != move.from_x || move.to_y != move.from_y) {
+            moves.push_back(move);
+        }
+    }
+
+    for (const Move& move : moves) {
+        allocations[move.id].x = move.to_x;
+        allocations[move.id].y = move.to_y;
+    }
+    space = std::move(repacked);
+    return moves;
+}
+
+// ==============================
+// Packers
+// ==============================
+
+const char* packer_name(PackerKind kind) {
+    switch (kind) {
+    case PackerKind::SHELF:             { return "shelf"; } break;
+    case PackerKind::SKYLINE_BL:        { return "skyline-bl"; } break;
+    case PackerKind::SKYLINE_MIN_WASTE: { return "skyline-min-waste"; } break;
+    case PackerKind::MAXRECTS_BSSF:     { return "maxrects-bssf"; } break;
+    case PackerKind::MAXRECTS_BLSF:     { return "maxrects-blsf"; } break;
+    case PackerKind::MAXRECTS_BAF:      { return "maxrects-baf"; } break;
+    case PackerKind::MAXRECTS_CONTACT:  { return "maxrects-contact"; } break;
+    case PackerKind::GUILLOTINE:        { return "guillotine"; } break;
+    case PackerKind::COUNT:             { } break;
+    }
+    return "?";
+}
+
+bool packer_from_name(const char* name, PackerKind* kind) {
+    for (u8 i = 0; i < (u8)PackerKind::COUNT; ++i) {
+        if (str::ieq(name, packer_name((PackerKind)i))) {
+            *kind = (PackerKind)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<Packer> make_packer(PackerKind kind) {
+    switch (kind) {
+    case PackerKind::SHELF:             { return std::unique_ptr<Packer>(new ShelfPacker()); } break;
+    case PackerKind::SKYLINE_BL:        { return std::unique_ptr<Packer>(new SkylinePacker(kind)); } break;
+    case PackerKind::SKYLINE_MIN_WASTE: { return std::unique_ptr<Packer>(new SkylinePacker(kind)); } break;
+    case PackerKind::MAXRECTS_BSSF:     { return std::unique_ptr<Packer>(new MaxRectsPacker(kind)); } break;
+    case PackerKind::MAXRECTS_BLSF:     { return std::unique_ptr<Packer>(new MaxRectsPacker(kind)); } break;
+    case PackerKind::MAXRECTS_BAF:      { return std::unique_ptr<Packer>(new MaxRectsPacker(kind)); } break;
+    case PackerKind::MAXRECTS_CONTACT:  { return std::unique_ptr<Packer>(new MaxRectsPacker(kind)); } break;
+    case PackerKind::GUILLOTINE:        { return make_guillotine_packer(DEFAULT_GUILLOTINE_OPTIONS); } break;
+    case PackerKind::COUNT:             { } break;
+    }
+    return nullptr;
+}
+
+PackStats pack_stats(u32 bin_w, u32 bin_h, Span<const PackRect> rects) {
+    PackStats stats = PackStats();
+    stats.count = (u32)rects.size();
+    for (const PackRect& r : rects) {
+        if (!r.packed) {
+            continue;
+        }
+        stats.packed += 1;
+        stats.packed_area += rect_area(r);
+        stats.bins = max(stats.bins, r.bin + 1);
+        stats.used_w = max(stats.used_w, r.x + r.w);
+        stats.used_h = max(stats.used_h, r.y + r.h);
+    }
+    const u64 bins_area = (u64)bin_w * bin_h * max<u32>(1, stats.bins);
+    stats.occupancy = bins_area > 0 ? (f64)stats.packed_area / (f64)bins_area : 0.0;
+    return stats;
+}
+
+PackCheck check_packing(u32 bin_w, u32 bin_h, Span<const PackRect> rects) {
+    PackCheck check = PackCheck();
+    check.overlap_a = UINT32_MAX;
+    check.overlap_b = UINT32_MAX;
+
+    // Per bin, left to right, and a rect's right edge before another's left edge at the same x, as edges are
+    // exclusive
+    struct Edge {
+        u32 bin;
+        u64 x;
+        bool left;
+        u32 index;
+    };
+    std::vector<Edge> edges = std::vector<Edge>();
+    edges.reserve(2 * rects.size());
+    for (usize i = 0; i < rects.size(); ++i) {
+        const PackRect& r = rects[i];
+        if (!r.packed) {
+            continue;
+        }
+        if ((u64)r.x + r.w > bin_w || (u64)r.y + r.h > bin_h) {
+            check.out_of_bounds += 1;
+        }
+        if (r.w > 0 && r.h > 0) {
+            edges.push_back({ r.bin, r.x, true, (u32)i });
+            edges.push_back({ r.bin, (u64)r.x + r.w, false, (u32)i });
+        }
+    }
+    std::sort(edges.begin(), edges.end(), [](const Edge& left, const Edge& right) {
+        if (left.bin != right.bin) { return left.bin < right.bin; }
+        if (left.x != right.x) { return left.x < right.x; }
+        if (left.left != right.left) { return !left.left; }
+        return left.index < right.index;
+    });
+
+    // Top edge, then index, of the rects crossing the sweep line
+    std::set<std::pair<u32, u32>> crossing = std::set<std::pair<u32, u32>>();
+    for (const Edge& e : edges) {
+        const PackRect& r = rects[e.index];
+        if (!e.left) {
+            crossing.erase({ r.y, e.index });
+            continue;
+        }
+
+        auto next = crossing.lower_bound({ r.y, 0 });
+        u32 other = UINT32_MAX;
+        if (next != crossing.end() && next->first < (u64)r.y + r.h) {
+            other = next->second;
+        } else if (next != crossing.begin() && (u64)std::prev(next)->first + rects[std::prev(next)->second].h > r.y) {
+            other = std::prev(next)->second;
+        }
+        if (other != UINT32_MAX) {
+            check.overlap_a = rects[other].id;
+            check.overlap_b = r.id;
+            break;
+        }
+        crossing.insert({ r.y, e.index });
+    }
+    return check;
+}
+
+// ==============================
+// Multiple bins
+// ==============================
+
+const char* bin_strategy_name(BinStrategy strategy) {
+    switch (strategy) {
+    case BinStrategy::SEQUENTIAL: { return "sequential"; } break;
+    case BinStrategy::DISTRIBUTE: { return "distribute"; } break;
+    case BinStrategy::COUNT:      { } break;
+    }
+    return "?";
+}
+
+bool bin_strategy_from_name(const char* name, BinStrategy* strategy) {
+    for (u8 i = 0; i < (u8)BinStrategy::COUNT; ++i) {
+        if (str::ieq(name, bin_strategy_name((BinStrategy)i))) {
+            *strategy = (BinStrategy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Packs pending into bins first_bin, first_bin + 1... until everything is placed. Rects go to done as they're
+// placed. Each bin only sees the next rects worth twice its area: the ones after that wouldn't fit anyway, short
+// of tiny ones filling holes, and it keeps this linear in the number of rects rather than bins x rects.
+static u32 pack_sequential(Packer* packer, u32 bin_w, u32 bin_h, std::vector<PackRect>* pending, u32 first_bin,
+    std::vector<PackRect>* done) {
+    const u64 window_area = 2 * (u64)bin_w * bin_h;
+    std::vector<PackRect> rest = std::vector<PackRect>();
+    u32 bin = first_bin;
+    usize start = 0;
+    while (start < pending->size()) {
+        usize end = start;
+        u64 area = 0;
+        while (end < pending->size() && (end == start || area + rect_area((*pending)[end]) <= window_area)) {
+            area += rect_area((*pending)[end]);
+            ++end;
+        }
+
+        Span<PackRect> window = Span<PackRect>(pending->data() + start, end - start);
+        packer->pack(bin_w, bin_h, window);
+        rest.clear();
+        for (PackRect& r : window) {
+            if (r.packed) {
+                r.bin = bin;
+                done->push_back(r);
+            } else {
+                rest.push_back(r);
+            }
+        }
+        // Unplaced rects go back in front of the ones the window didn't reach, in the same order
+        start = end - rest.size();
+        std::copy(rest.begin(), rest.end(), pending->begin() + start);
+        ++bin;
+    }
+    pending->clear();
+    return bin - first_bin;
+}
+
+u32 pack_bins(ThreadPool* pool, u32 bin_w, u32 bin_h, Span<PackRect> rects, const BinOptions& options) {
+    const u64 bin_area = (u64)bin_w * bin_h;
+    std::vector<PackRect> pending = std::vector<PackRect>();
+    std::vector<PackRect> done = std::vector<PackRect>();
+    pending.reserve(rects.size());
+    done.reserve(rects.size());
+    for (PackRect& r : rects) {
+        r.packed = false;
+        r.bin = 0;
+        const bool fits = (r.w <= bin_w && r.h <= bin_h) || (r.may_rotate && r.h <= bin_w && r.w <= bin_h);
+        if (r.w > 0 && r.h > 0 && fits) {
+            pending.push_back(r);
+        } else {
+            done.push_back(r);
+        }
+    }
+    sort_rects(pending, options.order);
+
+    u32 bins = 0;
+    if (options.strategy == BinStrategy::DISTRIBUTE) {
+        std::vector<std::vector<PackRect>> groups = std::vector<std::vector<PackRect>>();
+        std::vector<u64> group_area = std::vector<u64>();
+        std::vector<PackRect> overflow = std::vector<PackRect>();
+        std::mutex lock;
+        for (;;) {
+            u64 area = 0;
+            for (const PackRect& r : pending) {
+                area += rect_area(r);
+            }
+            const u64 count = (area + bin_area - 1) / bin_area;
+            if (count <= 1) {
+                break;
+            }
+
+            // Next rect to the group with the least area so far, so every bin gets a similar mix
+            groups.assign(count, std::vector<PackRect>());
+            group_area.assign(count, 0);
+            std::vector<std::pair<u64, u32>> heap = std::vector<std::pair<u64, u32>>();
+            for (u32 g = 0; g < (u32)count; ++g) {
+                heap.push_back({ 0, g });
+            }
+            auto lightest_first = [](const std::pair<u64, u32>& left, const std::pair<u64, u32>& right) {
+                return left > right;
+            };
+            for (const PackRect& r : pending) {
+                std::pop_heap(heap.begin(), heap.end(), lightest_first);
+                const u32 g = heap.back().second;
+                groups[g].push_back(r);
+                heap.back().first += rect_area(r);
+                std::push_heap(heap.begin(), heap.end(), lightest_first);
+            }
+
+            overflow.clear();
+            const u32 first_bin = bins;
+            for (u32 g = 0; g < (u32)count; ++g) {
+                pool->submit([&, g]() {
+                    std::vector<PackRect>& group = groups[g];
+                    make_packer(options.packer)->pack(bin_w, bin_h, group);
+                    std::lock_guard<std::mutex> lk(lock);
+                    for (PackRect& r : group) {
+                        if (r.packed) {
+                            r.bin = first_bin + g;
+                            done.push_back(r);
+                        } else {
+                            overflow.push_back(r);
+                        }
+                    }
+                });
+            }
+            pool->wait();
+            bins += (u32)count;
+
+            // Finish order varies, so put the overflow back in a fixed order
+            sort_rects_by_id(overflow);
+            sort_rects(overflow, options.order);
+            pending.swap(overflow);
+        }
+    }
+    std::unique_ptr<Packer> packer = make_packer(options.packer);
+    bins += pack_sequential(packer.get(), bin_w, bin_h, &pending, bins, &done);
+
+    std::copy(done.begin(), done.end(), rects.begin());
+    sort_rects_by_id(rects);
+    return bins;
+}
+
+// ==============================
+// Search
+// ==============================
+
+// Rough cost of each packer, cheapest first
+static u32 packer_cost(PackerKind kind) {
+    switch (kind) {
+    case PackerKind::SHELF:             { return 0; } break;
+    case PackerKind::GUILLOTINE:        { return 1; } break;
+    case PackerKind::SKYLINE_BL:        { return 2; } break;
+    case PackerKind::SKYLINE_MIN_WASTE: { return 3; } break;
+    case PackerKind::MAXRECTS_BSSF:     { return 4; } break;
+    case PackerKind::MAXRECTS_BLSF:     { return 4; } break;
+    case PackerKind::MAXRECTS_BAF:      { return 4; } break;
+    case PackerKind::MAXRECTS_CONTACT:  { return 5; } break;
+    case PackerKind::COUNT:             { } break;
+    }
+    return 6;
+}
+
+// Whether a is a better packing than b
+static bool better_packing(const PackStats& a, const PackStats& b) {
+    if (a.packed_area != b.packed_area) {
+        return a.packed_area > b.packed_area;
+    }
+    if (a.packed != b.packed) {
+        return a.packed > b.packed;
+    }
+    return (u64)a.used_w * a.used_h < (u64)b.used_w * b.used_h;
+}
+
+SolveResult solve_pack(ThreadPool* pool, u32 bin_w, u32 bin_h, Span<const PackRect> rects, const SolveOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<f64>(options.time_budget));
+
+    // Orienting only turns rects that may rotate; with none, every orientation would be the same candidate
+    bool any_may_rotate = false;
+    for (const PackRect& r : rects) {
+        any_may_rotate = any_may_rotate || r.may_rotate;
+    }
+    std::vector<PackCandidate> candidates = std::vector<PackCandidate>();
+    const u8 orientations = options.rotate && any_may_rotate ? (u8)Orientation::COUNT : 1;
+    for (u8 p = 0; p < (u8)PackerKind::COUNT; ++p) {
+        for (u8 o = 0; o < (u8)SortOrder::COUNT; ++o) {
+            for (u8 r = 0; r < orientations; ++r) {
+                candidates.push_back({ (PackerKind)p, (SortOrder)o, (Orientation)r });
+            }
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const PackCandidate& left, const PackCandidate& right) {
+        return packer_cost(left.packer) < packer_cost(right.packer);
+    });
+
+    SolveResult result = SolveResult();
+    result.candidates = (u32)candidates.size();
+    std::mutex lock;
+    usize best_index = SIZE_MAX;
+
+    // Workers take candidates in order, so the start order, unlike the finish order, is fixed
+    std::atomic<usize> next = std::atomic<usize>(0);
+    auto work = [&]() {
+        std::vector<PackRect> mine = std::vector<PackRect>();
+        for (usize i = next++; i < candidates.size(); i = next++) {
+            if (options.time_budget > 0 && Clock::now() >= deadline) {
+                return;
+            }
+            const PackCandidate& c = candidates[i];
+            mine.assign(rects.begin(), rects.end());
+            orient_rects(mine, c.orientation);
+            sort_rects(mine, c.order);
+            make_packer(c.packer)->pack(bin_w, bin_h, mine);
+            const PackStats stats = pack_stats(bin_w, bin_h, mine);
+
+            std::lock_guard<std::mutex> lk(lock);
+            result.tried += 1;
+            const bool better = best_index == SIZE_MAX || better_packing(stats, result.stats) ||
+                (!better_packing(result.stats, stats) && i < best_index);
+            if (better) {
+                best_index = i;
+                result.best = c;
+                result.stats = stats;
+                result.rects.swap(mine);
+            }
+        }
+    };
+    for (usize i = 0; i < min(pool->size(), candidates.size()); ++i) {
+        pool->submit(work);
+    }
+    pool->wait();
+
+    sort_rects_by_id(result.rects);
+    return result;
+}
+
+// ==============================
+// Corpus
+// ==============================
+
+const char* distribution_name(Distribution distribution) {
+    switch (distribution) {
+    case Distribution::UNIFORM:   { return "uniform"; } break;
+    case Distribution::POWER_LAW: { return "power-law"; } break;
+    case Distribution::GLYPHS:    { return "glyphs"; } break;
+    case Distribution::STRIPS:    { return "strips"; } break;
+    case Distribution::COUNT:     { } break;
+    }
+    return "?";
+}
+
+bool distribution_from_name(const char* name, Distribution* distribution) {
+    for (u8 i = 0; i < (u8)Distribution::COUNT; ++i) {
+        if (str::ieq(name, distribution_name((Distribution)i))) {
+            *distribution = (Distribution)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Integer only, so the corpus doesn't depend on the platform's floating point
+class CorpusRandom {
+private:
+    RandomXOR rng;
+public:
+    // Scrambled, as xorshift never leaves a zero state and close seeds would start out alike
+    explicit CorpusRandom(u32 seed) : rng(RandomXOR(max<u32>(1, (seed + 1) * 0x9E3779B1u))) {
+        for (u32 i = 0; i < 8; ++i) {
+            rng.next();
+        }
+    }
+
+    // In [lo, hi]
+    u32 range(u32 lo, u32 hi) {
+        return lo + (u32)(((u64)rng.next() * ((u64)hi - lo + 1)) >> 32);
+    }
+
+    // In [lo, hi], with P(v) ~ 1/v^2: v = lo * hi / u for u uniform in [lo, hi]
+    u32 power_law(u32 lo, u32 hi) {
+        return (u32)((u64)lo * hi / range(lo, hi));
+    }
+};
+
+std::vector<PackRect> generate_rects(const CorpusOptions& options) {
+    const u32 lo = max<u32>(1, options.min_size);
+    const u32 hi = max(lo, options.max_size);
+    CorpusRandom rng = CorpusRandom(options.seed);
+
+    // Glyph font sizes, spaced geometrically over the size range
+    u32 em[4] = { };
+    for (u32 i = 0; i < 4; ++i) {
+        em[i] = lo + (u32)((u64)(hi - lo) * (1u << i) / 8);
+    }
+
+    std::vector<PackRect> rects = std::vector<PackRect>(options.count);
+    for (u32 i = 0; i < options.count; ++i) {
+        PackRect& r = rects[i];
+        r.id = i;
+        switch (options.distribution) {
+        case Distribution::UNIFORM: {
+            r.w = rng.range(lo, hi);
+            r.h = rng.range(lo, hi);
+        } break;
+        case Distribution::POWER_LAW: {
+            const u32 side = rng.power_law(lo, hi);
+            const u32 other = (u32)((u64)side * rng.range(50, 200) / 100);
+            const bool wide = rng.range(0, 1) == 0;
+            r.w = clamp(wide ? other : side, lo, hi);
+            r.h = clamp(wide ? side : other, lo, hi);
+        } break;
+        case Distribution::GLYPHS: {
+            // Most glyphs are lowercase-sized, a few reach the full size
+            const u32 size = em[rng.range(0, 3)];
+            const u32 tall = rng.range(0, 3) == 0 ? 100 : 60;
+            r.w = max(lo, (u32)((u64)size * rng.range(25, 90) / 100));
+            r.h = max(lo, (u32)((u64)size * rng.range(tall - 20, tall) / 100));
+        } break;
+        case Distribution::STRIPS: {
+            const u32 side = rng.range(lo, hi);
+            const u32 thin = rng.range(1, max<u32>(1, lo / 8));
+            const bool lying = rng.range(0, 1) == 0;
+            r.w = lying ? side : thin;
+            r.h = lying ? thin : side;
+        } break;
+        case Distribution::COUNT: { } break;
+        }
+    }
+    return rects;
+}
+
+// ==============================
+// Rect lists
+// ==============================
+
+bool read_rects(const char* path, std::vector<PackRect>* rects) {
+    const bool from_stdin = strcmp(path, "-") == 0;
+    std::FILE* f = from_stdin ? stdin : std::fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    rects->clear();
+    bool ok = true;
+    char line[256];
+    while (ok && std::fgets(line, sizeof(line), f) != nullptr) {
+        char* comment = strchr(line, '#');
+        if (comment != nullptr) {
+            *comment = '\0';
+        }
+
+        u32 v[3] = { };
+        char pos[4][16] = { };
+        const int n = sscanf(line, "%u %u %u %15s %15s %15s %15s", &v[0], &v[1], &v[2], pos[0], pos[1], pos[2], pos[3]);
+        PackRect r = PackRect();
+        if (n <= 0) {
+            continue;
+        } else if (n == 2) {
+            r.id = (u32)rects->size();
+            r.w = v[0];
+            r.h = v[1];
+            char flag[2][2] = { };
+            const int flags = sscanf(line, "%*u %*u %1s %1s", flag[0], flag[1]);
+            r.may_rotate = flags == 1 && flag[0][0] == 'r';
+            ok = flags <= 0 || r.may_rotate;
+        } else if (n >= 5) {
+            r.id = v[0];
+            r.w = v[1];
+            r.h = v[2];
+            r.packed = strcmp(pos[0], "-") != 0;
+            r.x = r.packed ? (u32)strtoul(pos[0], nullptr, 10) : 0;
+            r.y = r.packed ? (u32)strtoul(pos[1], nullptr, 10) : 0;
+            // Then the bin, the rotation flag, or both
+            const bool has_bin = n >= 6 && strcmp(pos[2], "r") != 0;
+            r.bin = has_bin && r.packed ? (u32)strtoul(pos[2], nullptr, 10) : 0;
+            r.rotated = strcmp(pos[has_bin ? 3 : 2], "r") == 0;
+            ok = n <= (has_bin ? 7 : 6) && (n == (has_bin ? 6 : 5) || r.rotated);
+        } else {
+            ok = false;
+        }
+        rects->push_back(r);
+    }
+    ok = ok && !std::ferror(f);
+    if (!from_stdin) {
+        std::fclose(f);
+    }
+    return ok;
+}
+
+bool write_rects(const char* path, Span<const PackRect> rects, const char* comment) {
+    const bool to_stdout = strcmp(path, "-") == 0;
+    std::FILE* f = to_stdout ? stdout : std::fopen(path, "wb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    if (comment != nullptr) {
+        fprintf(f, "# %s\n", comment);
+    }
+    for (const PackRect& r : rects) {
+        const char* rotated = r.rotated ? " r" : "";
+        if (r.packed) {
+            fprintf(f, "%u %u %u %u %u %u%s\n", r.id, r.w, r.h, r.x, r.y, r.bin, rotated);
+        } else {
+            fprintf(f, "%u %u %u - - -%s\n", r.id, r.w, r.h, rotated);
+        }
+    }
+
+    bool ok = !std::ferror(f);
+    if (!to_stdout) {
+        ok = (std::fclose(f) == 0) && ok;
+    } else {
+        ok = (std::fflush(f) == 0) && ok;
+    }
+    return ok;
+}
+
+}
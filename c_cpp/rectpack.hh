@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef _FUN_RECTPACK_HH_
+#define _FUN_RECTPACK_HH_
+
+#include "hk.hh"
+#include "threads.hh"
+
+#include <memory>
+
+namespace hk {
+
+// ==============================
+// Rectangles
+// ==============================
+
+// Integer sizes and positions, so packing is exact. id is the rect's index in the input and survives reordering.
+// w and h are as placed; rotated means that's the input turned by 90 degrees, so UVs need flipping. Packers may
+// turn rects with may_rotate set, where that fits better. bin is the page, for multi-bin packing.
+struct PackRect {
+    u32 id;
+    u32 w;
+    u32 h;
+    u32 x;
+    u32 y;
+    u32 bin;
+    bool packed;
+    bool rotated;
+    bool may_rotate;
+};
+
+enum class SortOrder : u8 {
+    NONE,
+    AREA,
+    AREA_DESC,
+    HEIGHT,
+    COUNT
+};
+
+const char* sort_order_name(SortOrder order);
+bool sort_order_from_name(const char* name, SortOrder* order);
+
+// Stable, ties keep input order. Radix sorts precomputed integer keys, then moves each rect once
+void sort_rects(Span<PackRect> rects, SortOrder order);
+
+// Back to input order
+void sort_rects_by_id(Span<PackRect> rects);
+
+// Turns rects before packing: as given, all landscape (w >= h) or all portrait. Only rects with may_rotate are
+// turned.
+enum class Orientation : u8 {
+    AS_GIVEN,
+    WIDE,
+    TALL,
+    COUNT
+};
+
+const char* orientation_name(Orientation orientation);
+bool orientation_from_name(const char* name, Orientation* orientation);
+
+void orient_rects(Span<PackRect> rects, Orientation orientation);
+
+// ==============================
+// Packers
+// ==============================
+
+// Shelf: rows left to right, each as tall as its tallest rect.
+// Skyline: on top of the outline of what's packed so far, at the lowest top edge (bottom-left) or where the least
+// area is left unusable under the rect (min-waste).
+// MaxRects: in the free rectangle with the best short side fit, long side fit or area fit, or where the rect touches
+// the most edges of the bin and other rects (contact point). Slowest and tightest. Contact point is out of scope for
+// large inputs: how much a spot touches has nothing to do with its free rect's size, so it still bounds every free
+// rect a rect fits in, one by one. Expect over a second for 50k rects, where the other MaxRects heuristics take a
+// fraction of that.
+// Guillotine: in a free rectangle, which is then cut in two with straight cuts, so packed rects can always be
+// separated by edge-to-edge cuts. make_guillotine_packer() for other than the default options.
+enum class PackerKind : u8 {
+    SHELF,
+    SKYLINE_BL,
+    SKYLINE_MIN_WASTE,
+    MAXRECTS_BSSF,
+    MAXRECTS_BLSF,
+    MAXRECTS_BAF,
+    MAXRECTS_CONTACT,
+    GUILLOTINE,
+    COUNT
+};
+
+const char* packer_name(PackerKind kind);
+bool packer_from_name(const char* name, PackerKind* kind);
+
+// Offline packer: places rects one by one, in the given order, into a single bin_w x bin_h bin, bin 0. Rects that
+// don't fit are left with packed = false. Rects with may_rotate are tried both ways and placed whichever way scores
+// better, swapping w and h and toggling rotated if turned. Packers keep no state between pack() calls.
+class Packer {
+public:
+    virtual ~Packer() = default;
+    virtual PackerKind kind() const = 0;
+    virtual void pack(u32 bin_w, u32 bin_h, Span<PackRect> rects) = 0;
+};
+
+std::unique_ptr<Packer> make_packer(PackerKind kind);
+
+// Which free rectangle a rect goes into
+enum class GuillotineChoice : u8 {
+    BEST_AREA,
+    BEST_SHORT_SIDE,
+    BEST_LONG_SIDE,
+    WORST_AREA,
+    COUNT
+};
+
+const char* guillotine_choice_name(GuillotineChoice choice);
+bool guillotine_choice_from_name(const char* name, GuillotineChoice* choice);
+
+// Which way the leftover space is cut: whether the cut across the whole free rect is horizontal or vertical is
+// picked by comparing the leftover sides, the areas of the resulting pieces or the free rect's sides.
+enum class GuillotineSplit : u8 {
+    SHORTER_LEFTOVER,
+    LONGER_LEFTOVER,
+    MIN_AREA,
+    MAX_AREA,
+    SHORTER_AXIS,
+    LONGER_AXIS,
+    COUNT
+};
+
+const char* guillotine_split_name(GuillotineSplit split);
+bool guillotine_split_from_name(const char* name, GuillotineSplit* split);
+
+struct GuillotineOptions {
+    GuillotineChoice choice;
+    GuillotineSplit split;
+    // Joins free rects sharing a whole edge back into one
+    bool merge;
+};
+
+constexpr GuillotineOptions DEFAULT_GUILLOTINE_OPTIONS = {
+    GuillotineChoice::BEST_AREA, GuillotineSplit::SHORTER_LEFTOVER, true
+};
+
+std::unique_ptr<Packer> make_guillotine_packer(const GuillotineOptions& options);
+
+// ==============================
+// Online packing
+// ==============================
+
+class GuillotineSpace;
+
+// Best short side fit is the one guillotine choice that takes O(log n) however fragmented the free space is
+constexpr GuillotineOptions DEFAULT_ATLAS_OPTIONS = {
+    GuillotineChoice::BEST_SHORT_SIDE, GuillotineSplit::SHORTER_LEFTOVER, true
+};
+
+// Allocator for live atlases like glyph caches and streamed sprites, where rects come and go one at a time.
+// allocate() and free() are O(log n) in the number of free rects, on the same free space index as the guillotine
+// packer. Freed space only rejoins neighbours it shares a whole edge with, so a long-lived atlas fragments: stats()
+// measures it and defragment() repacks what's live.
+//
+// Ids of freed allocations are reused.
+class AtlasAllocator {
+public:
+    static constexpr u32 INVALID = UINT32_MAX;
+
+    struct Allocation {
+        u32 x;
+        u32 y;
+        u32 w;
+        u32 h;
+    };
+
+    struct Stats {
+        u32 allocations;
+        u64 used_area;
+        u64 free_area;
+        u32 free_rects;
+        u64 largest_free_area;
+        // 1 - largest free rect / free area: 0 when the free space is one rect, towards 1 as it crumbles
+        f64 fragmentation;
+    };
+
+    // Moves can overlap each other's old positions, so copy from a snapshot of the atlas
+    struct Move {
+        u32 id;
+        u32 from_x;
+        u32 from_y;
+        u32 to_x;
+        u32 to_y;
+    };
+private:
+    u32 bin_w;
+    u32 bin_h;
+    GuillotineOptions options;
+    std::unique_ptr<GuillotineSpace> space;
+    std::vector<Allocation> allocations;
+    std::vector<u8> live;
+    std::vector<u32> free_ids;
+    u64 used_area;
+public:
+    AtlasAllocator(u32 bin_w, u32 bin_h, const GuillotineOptions& options = DEFAULT_ATLAS_OPTIONS);
+    ~AtlasAllocator();
+
+    AtlasAllocator(const AtlasAllocator&) = delete;
+    AtlasAllocator& operator=(const AtlasAllocator&) = delete;
+
+    void clear();
+
+    // Id of the new allocation, INVALID if there's no room
+    u32 allocate(u32 w, u32 h);
+    // False if id isn't allocated
+    bool free(u32 id);
+
+    bool is_live(u32 id) const {
+        return id < live.size() && live[id];
+    }
+
+    const Allocation& get(u32 id) const {
+        return allocations[id];
+    }
+
+    // O(free rects)
+    Stats stats() const;
+
+    // Repacks every live allocation, largest first, and returns the ones that moved. Nothing moves, and the list
+    // is empty, if they don't all fit when packed together.
+    std::vector<Move> defragment();
+};
+
+struct PackStats {
+    u32 count;
+    u32 packed;
+    u64 packed_area;
+    // Highest bin used, plus one
+    u32 bins;
+    // Bounding box of the packed rects, over all bins
+    u32 used_w;
+    u32 used_h;
+    // Packed area over the area of all bins used
+    f64 occupancy;
+};
+
+PackStats pack_stats(u32 bin_w, u32 bin_h, Span<const PackRect> rects);
+
+struct PackCheck {
+    // Packed rects reaching past the bin
+    u32 out_of_bounds;
+    // Ids of the first two packed rects found overlapping in the same bin, UINT32_MAX if none
+    u32 overlap_a;
+    u32 overlap_b;
+
+    bool ok() const {
+        return out_of_bounds == 0 && overlap_a == UINT32_MAX;
+    }
+};
+
+// Checks that every packed rect lies inside its bin and that no two in the same bin overlap, in O(n log n): a
+// sweep along x keeps the rects crossing the sweep line ordered by y, where they must be disjoint, so each new one
+// only has to be compared with its neighbours there. Rects with no area are skipped.
+PackCheck check_packing(u32 bin_w, u32 bin_h, Span<const PackRect> rects);
+
+// ==============================
+// Multiple bins
+// ==============================
+
+enum class BinStrategy : u8 {
+    // Each bin takes what fits of the remaining rects before the next one opens, one bin at a time. With a sorted
+    // order, each bin gets rects of about one size, which leaves the bins of large ones with gaps nothing fills.
+    SEQUENTIAL,
+    // Rects are dealt out by area to as many bins as their total area needs at least, so each gets the same mix of
+    // sizes, a pool job packs each bin, and what didn't fit is dealt out again to new bins. The last bin's worth is
+    // packed sequentially. Best with a sorted order.
+    DISTRIBUTE,
+    COUNT
+};
+
+const char* bin_strategy_name(BinStrategy strategy);
+bool bin_strategy_from_name(const char* name, BinStrategy* strategy);
+
+struct BinOptions {
+    PackerKind packer;
+    SortOrder order;
+    BinStrategy strategy;
+};
+
+// Packs every rect into as many bin_w x bin_h bins as needed and returns how many. Only rects that don't fit in a
+// bin either way they may be placed are left unpacked. rects come back in id order. Blocks until done; must not be called from a pool job.
+u32 pack_bins(ThreadPool* pool, u32 bin_w, u32 bin_h, Span<PackRect> rects, const BinOptions& options);
+
+// ==============================
+// Search
+// ==============================
+
+struct PackCandidate {
+    PackerKind packer;
+    SortOrder order;
+    Orientation orientation;
+};
+
+struct SolveOptions {
+    // Seconds; candidates not started by then are skipped, 0 runs them all
+    f64 time_budget;
+    // Also try every rect that may rotate turned wide and turned tall
+    bool rotate;
+};
+
+struct SolveResult {
+    PackCandidate best;
+    PackStats stats;
+    u32 tried;
+    u32 candidates;
+    // The best packing, in id order
+    std::vector<PackRect> rects;
+};
+
+// Packs with every packer x sort order (x orientation) on the pool and keeps the best: most packed area, then most
+// rects, then the smallest bounding box, then the first candidate in enumeration order, so the winner never
+// depends on thread timing. Candidates start cheapest packer first, so a tight budget drops the slow ones. Blocks
+// until done; must not be called from a pool job.
+SolveResult solve_pack(ThreadPool* pool, u32 bin_w, u32 bin_h, Span<const PackRect> rects, const SolveOptions& options);
+
+// ==============================
+// Corpus
+// ==============================
+
+// Bumped whenever a distribution's output for the same options changes, so results from different versions aren't
+// compared as if they were the same input
+constexpr u32 CORPUS_VERSION = 1;
+
+// Uniform: both sides uniform in [min_size, max_size].
+// Power law: mostly small rects and a long tail of large ones, the side distributed ~ 1/side^2, aspect up to 2:1.
+// Glyphs: a few font sizes, each glyph a fraction of its size wide and tall, like a glyph cache's contents.
+// Strips: one side in [min_size, max_size], the other at most an eighth of min_size, lying or standing.
+enum class Distribution : u8 {
+    UNIFORM,
+    POWER_LAW,
+    GLYPHS,
+    STRIPS,
+    COUNT
+};
+
+const char* distribution_name(Distribution distribution);
+bool distribution_from_name(const char* name, Distribution* distribution);
+
+struct CorpusOptions {
+    Distribution distribution;
+    u32 count;
+    u32 min_size;
+    u32 max_size;
+    u32 seed;
+};
+
+// Same options and CORPUS_VERSION, same rects, on every platform. Real size dumps are rect lists, see read_rects().
+std::vector<PackRect> generate_rects(const CorpusOptions& options);
+
+// ==============================
+// Rect lists
+// ==============================
+
+// Text, one rect per line: "<w> <h>" for inputs, with a trailing "r" on ones that may be rotated, and
+// "<id> <w> <h> <x> <y> <bin>" for results, with "-" for the position and bin of rects that weren't packed and a
+// trailing "r" on rotated ones. Results can be read back as inputs, also without the bin. '#' starts a comment.
+// "-" is stdin/stdout.
+bool read_rects(const char* path, std::vector<PackRect>* rects);
+bool write_rects(const char* path, Span<const PackRect> rects, const char* comment = nullptr);
+
+}
+
+#endif // _FUN_RECTPACK_HH_
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef _FUN_THREADS_HH_
+#define _FUN_THREADS_HH_
+
+#include "hk.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace hk {
+
+// ==============================
+// Thread pool
+// ==============================
+
+// Work-stealing thread pool. Every worker owns a deque: jobs submitted from inside a job go to the back of the
+// submitting worker's deque and are popped LIFO (keeps recursive work cache-warm), idle workers steal from the
+// front of other deques. Jobs submitted from outside the pool are spread round-robin.
+class ThreadPool {
+public:
+    using Job = std::function<void()>;
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::thread> threads;
+    std::unique_ptr<Queue[]> queues;
+    usize count;
+
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<usize> queued;
+    usize outstanding;
+    usize next_queue;
+    bool stopping;
+public:
+    // threads = 0 uses one worker per hardware thread
+    explicit ThreadPool(usize threads = 0) : queued(0), outstanding(0), next_queue(0), stopping(false) {
+        if (threads == 0) {
+            threads = max<usize>(1, std::thread::hardware_concurrency());
+        }
+        count = threads;
+        queues = std::unique_ptr<Queue[]>(new Queue[count]);
+        for (usize i = 0; i < count; ++i) {
+            this->threads.emplace_back([this, i]() { worker(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(sleep_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    usize size() const {
+        return count;
+    }
+
+    void submit(Job job) {
+        usize index = 0;
+        {
+            std::lock_guard<std::mutex> lk(sleep_lock);
+            outstanding += 1;
+            queued += 1;
+            index = (current() == this) ? current_index() : (next_queue++ % count);
+        }
+        {
+            std::lock_guard<std::mutex> lk(queues[index].lock);
+            queues[index].jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // Block until every submitted job, including jobs submitted by other jobs, has finished. Must not be called
+    // from inside a job.
+    void wait() {
+        HK_ASSERT(current() != this);
+        std::unique_lock<std::mutex> lk(sleep_lock);
+        idle.wait(lk, [this]() { return outstanding == 0; });
+    }
+private:
+    static ThreadPool*& current() {
+        static thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    static usize& current_index() {
+        static thread_local usize index = 0;
+        return index;
+    }
+
+    bool pop(usize index, Job* job) {
+        {
+            Queue& own = queues[index];
+            std::lock_guard<std::mutex> lk(own.lock);
+            if (!own.jobs.empty()) {
+                *job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                return true;
+            }
+        }
+        for (usize i = 1; i < count; ++i) {
+            Queue& victim = queues[(index + i) % count];
+            std::lock_guard<std::mutex> lk(victim.lock);
+            if (!victim.jobs.empty()) {
+                *job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker(usize index) {
+        current() = this;
+        current_index() = index;
+        for (;;) {
+            Job job;
+            if (pop(index, &job)) {
+                queued -= 1;
+                job();
+                std::lock_guard<std::mutex> lk(sleep_lock);
+                if (--outstanding == 0) {
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lk(sleep_lock);
+            wake.wait(lk, [this]() { return stopping || queued > 0; });
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
+};
+
+}
+
+#endif // _FUN_THREADS_HH_